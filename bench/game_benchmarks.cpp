@@ -0,0 +1,310 @@
+#include <benchmark/benchmark.h>
+
+#include "application.h"
+#include "game_snapshot.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+    std::atomic<uint64_t> allocations{ 0 };
+
+}  // namespace
+
+// Every allocation in the process goes through here, so a benchmark can report how
+// many its loop makes; the array and nothrow forms forward to these. Kept out of
+// line, or GCC pairs the inlined malloc with the inlined free and warns.
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+    // Counts allocations while running; Pause and Resume bracket untimed work the
+    // way State::PauseTiming does. Report adds an allocs-per-iteration counter.
+    class AllocationCounter {
+    public:
+        AllocationCounter() noexcept
+            : started_at_(allocations.load(std::memory_order_relaxed)) {
+        }
+
+        void Pause() noexcept {
+            counted_ += allocations.load(std::memory_order_relaxed) - started_at_;
+        }
+
+        void Resume() noexcept {
+            started_at_ = allocations.load(std::memory_order_relaxed);
+        }
+
+        void Report(benchmark::State& state) noexcept {
+            Pause();
+            state.counters["allocs"] = benchmark::Counter(static_cast<double>(counted_),
+                benchmark::Counter::kAvgIterations);
+        }
+
+    private:
+        uint64_t started_at_;
+        uint64_t counted_ = 0;
+    };
+
+    constexpr uint32_t SEED = 20240601;
+    constexpr int GRID_SIDE = 64;
+    constexpr int GRID_SPACING = 10;
+    const model::Map::Id MAP_ID{ "bench" };
+
+    // Square grid of crossing roads with an office at every fourth crossing, so
+    // moves hit road ends, crossings and offices all over the map.
+    model::Map MakeGridMap(int loot_items) {
+        model::Map map{ MAP_ID, "Bench grid" };
+        const int extent = (GRID_SIDE - 1) * GRID_SPACING;
+        for (int i = 0; i < GRID_SIDE; ++i) {
+            const int offset = i * GRID_SPACING;
+            map.AddRoad(model::Road{ model::Road::HORIZONTAL, { 0, offset }, extent });
+            map.AddRoad(model::Road{ model::Road::VERTICAL, { offset, 0 }, extent });
+        }
+        for (int x = 0; x < GRID_SIDE; x += 4) {
+            for (int y = 0; y < GRID_SIDE; y += 4) {
+                map.AddOffice(model::Office{ model::Office::Id{ "o" + std::to_string(x) + "-" + std::to_string(y) },
+                    { x * GRID_SPACING, y * GRID_SPACING }, { 0, 0 } });
+            }
+        }
+
+        util::Xoshiro256 rng{ SEED };
+        for (int i = 0; i < loot_items; ++i) {
+            map.AddLootItem(model::LootItem{ model::LootItem::Id{ -1 - i }, i % 4, 10.0, map.GetRandomRoadPosition(rng) });
+        }
+        map.SetDogSpeed(3.0);
+        return map;
+    }
+
+    struct World {
+        explicit World(int dogs) {
+            game.AddMap(MakeGridMap(0));
+            application = std::make_unique<app::Application>(game, true, 1e9, SEED);
+            // Snapshot rebuilds are held back like on the server's game thread, so a
+            // burst of joins or moves costs one rebuild instead of one each.
+            application->SetGameTaskPoster([this](std::function<void()> task) {
+                game_tasks.push_back(std::move(task));
+            });
+            tokens.reserve(dogs);
+            for (int i = 0; i < dogs; ++i) {
+                tokens.push_back(application->JoinGame("dog" + std::to_string(i), *MAP_ID)->auth_token);
+            }
+            RunGameTasks();
+        }
+
+        void RunGameTasks() {
+            auto tasks = std::move(game_tasks);
+            game_tasks.clear();
+            for (auto& task : tasks) {
+                task();
+            }
+        }
+
+        void Steer(util::Xoshiro256& rng) {
+            constexpr app::PlayerMove moves[] = {
+                app::PlayerMove::Left, app::PlayerMove::Right, app::PlayerMove::Up, app::PlayerMove::Down,
+            };
+            std::uniform_int_distribution<size_t> pick(0, std::size(moves) - 1);
+            for (const auto& token : tokens) {
+                application->SetPlayerAction(*application->FindPlayerByToken(token), moves[pick(rng)]);
+            }
+            RunGameTasks();
+        }
+
+        model::Game game;
+        std::unique_ptr<app::Application> application;
+        std::vector<std::string> tokens;
+        std::vector<std::function<void()>> game_tasks;
+    };
+
+    // Joining 100k players dominates setup, so each size is built once per process.
+    World& GetWorld(int dogs) {
+        static std::map<int, std::unique_ptr<World>> worlds;
+        auto& world = worlds[dogs];
+        if (!world) {
+            world = std::make_unique<World>(dogs);
+        }
+        return *world;
+    }
+
+    void BM_Tick(benchmark::State& state) {
+        auto& world = GetWorld(static_cast<int>(state.range(0)));
+        util::Xoshiro256 rng{ SEED };
+        int64_t ticks = 0;
+        AllocationCounter allocs;
+        for (auto _ : state) {
+            // Dogs stop at road ends; keep them moving without timing the steering.
+            if (ticks++ % 10 == 0) {
+                state.PauseTiming();
+                allocs.Pause();
+                world.Steer(rng);
+                allocs.Resume();
+                state.ResumeTiming();
+            }
+            world.application->Tick(50ms);
+        }
+        allocs.Report(state);
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+    BENCHMARK(BM_Tick)->Arg(1'000)->Arg(10'000)->Arg(100'000)->Unit(benchmark::kMillisecond);
+
+    // GatherCollisionEvents is private to Application; this drives the same spatial
+    // query and hit test it runs for each dog, at a given loot density.
+    void BM_CollisionCandidates(benchmark::State& state) {
+        const auto map = MakeGridMap(static_cast<int>(state.range(0)));
+        constexpr double radius = 0.3;
+        constexpr double step = 0.15;
+
+        util::Xoshiro256 rng{ SEED };
+        std::vector<std::pair<model::Position, model::Position>> moves;
+        for (int i = 0; i < 1'000; ++i) {
+            const auto start = map.GetRandomRoadPosition(rng);
+            const bool along_x = rng() % 2 == 0;
+            moves.push_back({ start, { start.x + (along_x ? step : 0.0), start.y + (along_x ? 0.0 : step) } });
+        }
+
+        for (auto _ : state) {
+            size_t hits = 0;
+            for (const auto& [start, end] : moves) {
+                map.ForEachLootCandidate(start, end, radius, [&](const model::LootItem& loot) {
+                    const auto pos = loot.GetPosition();
+                    const double dx = pos.x - end.x;
+                    const double dy = pos.y - end.y;
+                    hits += dx * dx + dy * dy <= radius * radius;
+                });
+            }
+            benchmark::DoNotOptimize(hits);
+        }
+        state.SetItemsProcessed(state.iterations() * moves.size());
+    }
+    BENCHMARK(BM_CollisionCandidates)->Arg(0)->Arg(1'000)->Arg(10'000)->Arg(100'000);
+
+    void BM_FindPlayerByToken(benchmark::State& state) {
+        auto& world = GetWorld(static_cast<int>(state.range(0)));
+        util::Xoshiro256 rng{ SEED };
+        std::uniform_int_distribution<size_t> pick(0, world.tokens.size() - 1);
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(world.application->FindPlayerByToken(world.tokens[pick(rng)]));
+        }
+    }
+    BENCHMARK(BM_FindPlayerByToken)->Arg(1'000)->Arg(10'000)->Arg(100'000);
+
+    // What /game/state does before writing: resolve the token, load the published
+    // snapshot. Neither step should allocate.
+    void BM_StatePath(benchmark::State& state) {
+        auto& world = GetWorld(static_cast<int>(state.range(0)));
+        util::Xoshiro256 rng{ SEED };
+        std::uniform_int_distribution<size_t> pick(0, world.tokens.size() - 1);
+        AllocationCounter allocs;
+        for (auto _ : state) {
+            const auto player = world.game.FindPlayerRefByToken(world.tokens[pick(rng)]);
+            benchmark::DoNotOptimize(world.application->GetMapSnapshot(player->map_index));
+        }
+        allocs.Report(state);
+    }
+    BENCHMARK(BM_StatePath)->Arg(10'000)->Arg(100'000);
+
+    // An auto tick mode action: resolve the token and queue the move. The queue is
+    // drained by an untimed tick every ACTIONS_PER_TICK actions.
+    void BM_ActionPath(benchmark::State& state) {
+        constexpr int64_t ACTIONS_PER_TICK = 1024;
+        auto& world = GetWorld(static_cast<int>(state.range(0)));
+        util::Xoshiro256 rng{ SEED };
+        std::uniform_int_distribution<size_t> pick(0, world.tokens.size() - 1);
+        int64_t actions = 0;
+        AllocationCounter allocs;
+        for (auto _ : state) {
+            const auto player = world.game.FindPlayerHandleByToken(world.tokens[pick(rng)]);
+            world.application->QueuePlayerAction(*player, app::PlayerMove::Left);
+            if (++actions % ACTIONS_PER_TICK == 0) {
+                state.PauseTiming();
+                allocs.Pause();
+                world.application->Tick(0ms);
+                allocs.Resume();
+                state.ResumeTiming();
+            }
+        }
+        allocs.Report(state);
+    }
+    BENCHMARK(BM_ActionPath)->Arg(10'000)->Arg(100'000);
+
+    void BM_BuildMapSnapshot(benchmark::State& state) {
+        auto& world = GetWorld(static_cast<int>(state.range(0)));
+        std::vector<const model::Player*> players;
+        for (const auto& player : world.game.GetPlayers()) {
+            players.push_back(&player);
+        }
+
+        uint64_t tick = 0;
+        size_t bytes = 0;
+        for (auto _ : state) {
+            auto snapshot = app::BuildMapSnapshot(world.game, 0, players, ++tick);
+            bytes += snapshot.state.size() + snapshot.players.size();
+            benchmark::DoNotOptimize(snapshot);
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(bytes));
+    }
+    BENCHMARK(BM_BuildMapSnapshot)->Arg(1'000)->Arg(10'000)->Unit(benchmark::kMicrosecond);
+
+    // Runs inside the tick whenever a save is due; the file write happens off it.
+    void BM_SaveState(benchmark::State& state) {
+        auto& world = GetWorld(static_cast<int>(state.range(0)));
+        size_t bytes = 0;
+        for (auto _ : state) {
+            auto saved = world.application->SaveState();
+            bytes += saved.size();
+            benchmark::DoNotOptimize(saved);
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(bytes));
+    }
+    BENCHMARK(BM_SaveState)->Arg(10'000)->Arg(100'000)->Unit(benchmark::kMillisecond);
+
+    // Startup cost of a restart: rebuilding every session from a saved state.
+    void BM_RestoreState(benchmark::State& state) {
+        const auto saved = GetWorld(static_cast<int>(state.range(0))).application->SaveState();
+        for (auto _ : state) {
+            state.PauseTiming();
+            auto game = std::make_unique<model::Game>();
+            game->AddMap(MakeGridMap(0));
+            auto application = std::make_unique<app::Application>(*game, true, 1e9, SEED);
+            state.ResumeTiming();
+
+            benchmark::DoNotOptimize(application->RestoreState(saved));
+
+            state.PauseTiming();
+            application.reset();
+            game.reset();
+            state.ResumeTiming();
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+    BENCHMARK(BM_RestoreState)->Arg(10'000)->Arg(100'000)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,224 @@
+#include "metrics.h"
+#include "random.h"
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/json.hpp>
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace json = boost::json;
+namespace po = boost::program_options;
+
+using tcp = net::ip::tcp;
+using namespace std::literals;
+
+namespace {
+
+struct Options {
+    std::string host;
+    std::string port;
+    std::string map_id;
+    unsigned connections = 0;
+    std::chrono::seconds duration{ 0 };
+    uint32_t seed = 0;
+};
+
+struct Stats {
+    metrics::LatencyHistogram join;
+    metrics::LatencyHistogram action;
+    metrics::LatencyHistogram state;
+    std::atomic<uint64_t> errors{ 0 };
+};
+
+std::optional<Options> ParseCommandLine(int argc, const char* argv[]) {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("host", po::value<std::string>()->default_value("127.0.0.1"), "server address")
+        ("port", po::value<std::string>()->default_value("8080"), "server port")
+        ("map", po::value<std::string>()->required(), "map id to join")
+        ("connections,n", po::value<unsigned>()->default_value(64), "keep-alive connections, one player each")
+        ("duration,d", po::value<int>()->default_value(30), "seconds to run")
+        ("seed", po::value<uint32_t>()->default_value(1), "seed for the move sequence of every connection")
+    ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return std::nullopt;
+        }
+        po::notify(vm);
+    } catch (const po::error& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cerr << desc << "\n";
+        return std::nullopt;
+    }
+
+    Options options;
+    options.host = vm["host"].as<std::string>();
+    options.port = vm["port"].as<std::string>();
+    options.map_id = vm["map"].as<std::string>();
+    options.connections = std::max(1u, vm["connections"].as<unsigned>());
+    options.duration = std::chrono::seconds{ vm["duration"].as<int>() };
+    options.seed = vm["seed"].as<uint32_t>();
+    return options;
+}
+
+class Client {
+public:
+    Client(const Options& options, Stats& stats)
+        : options_(options)
+        , stats_(stats)
+        , stream_(ioc_) {
+        Connect();
+    }
+
+    http::response<http::string_body> Exchange(http::request<http::string_body>& req,
+        metrics::LatencyHistogram& histogram) {
+        req.set(http::field::host, options_.host);
+        req.keep_alive(true);
+        req.prepare_payload();
+
+        const auto started_at = std::chrono::steady_clock::now();
+        http::write(stream_, req);
+        http::response<http::string_body> res;
+        http::read(stream_, buffer_, res);
+        histogram.Record(std::chrono::steady_clock::now() - started_at);
+
+        if (res.result() != http::status::ok) {
+            stats_.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (res.need_eof()) {
+            Reconnect();
+        }
+        return res;
+    }
+
+private:
+    void Connect() {
+        tcp::resolver resolver{ ioc_ };
+        stream_.connect(resolver.resolve(options_.host, options_.port));
+        stream_.socket().set_option(tcp::no_delay{ true });
+    }
+
+    void Reconnect() {
+        beast::error_code ec;
+        stream_.socket().shutdown(tcp::socket::shutdown_both, ec);
+        stream_.close();
+        buffer_.clear();
+        Connect();
+    }
+
+    const Options& options_;
+    Stats& stats_;
+    net::io_context ioc_;
+    beast::tcp_stream stream_;
+    beast::flat_buffer buffer_;
+};
+
+void RunConnection(const Options& options, unsigned index, std::chrono::steady_clock::time_point deadline,
+    Stats& stats) {
+    try {
+        Client client{ options, stats };
+
+        http::request<http::string_body> join{ http::verb::post, "/api/v1/game/join", 11 };
+        join.set(http::field::content_type, "application/json");
+        join.body() = json::serialize(json::object{
+            { "userName", "loadgen-" + std::to_string(index) },
+            { "mapId", options.map_id },
+        });
+        auto joined = client.Exchange(join, stats.join);
+        if (joined.result() != http::status::ok) {
+            return;
+        }
+        const std::string authorization = "Bearer "s
+            + std::string(json::parse(joined.body()).as_object().at("authToken").as_string());
+
+        // Every connection replays its own fixed sequence, so runs are comparable.
+        util::Xoshiro256 rng{ options.seed + index };
+        constexpr std::string_view moves[] = { "L"sv, "R"sv, "U"sv, "D"sv, ""sv };
+        std::uniform_int_distribution<size_t> pick(0, std::size(moves) - 1);
+
+        while (std::chrono::steady_clock::now() < deadline) {
+            http::request<http::string_body> action{ http::verb::post, "/api/v1/game/player/action", 11 };
+            action.set(http::field::authorization, authorization);
+            action.set(http::field::content_type, "application/json");
+            action.body() = "{\"move\":\"" + std::string(moves[pick(rng)]) + "\"}";
+            client.Exchange(action, stats.action);
+
+            http::request<http::string_body> state{ http::verb::get, "/api/v1/game/state", 11 };
+            state.set(http::field::authorization, authorization);
+            client.Exchange(state, stats.state);
+        }
+    } catch (const std::exception& e) {
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+        std::cerr << "Connection " << index << " failed: " << e.what() << std::endl;
+    }
+}
+
+void Report(std::string_view name, const metrics::LatencyHistogram& histogram, std::chrono::duration<double> elapsed) {
+    auto ms = [&histogram](double q) {
+        return histogram.QuantileSeconds(q) * 1000.0;
+    };
+    std::cout << std::left << std::setw(8) << name << std::right
+        << std::setw(10) << histogram.Count()
+        << std::setw(12) << std::fixed << std::setprecision(1) << histogram.Count() / elapsed.count()
+        << std::setw(10) << std::setprecision(3) << ms(0.5)
+        << std::setw(10) << ms(0.99)
+        << std::setw(10) << ms(0.999) << "\n";
+}
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+    auto options = ParseCommandLine(argc, argv);
+    if (!options) {
+        return EXIT_FAILURE;
+    }
+
+    Stats stats;
+    const auto started_at = std::chrono::steady_clock::now();
+    const auto deadline = started_at + options->duration;
+    {
+        std::vector<std::jthread> workers;
+        workers.reserve(options->connections);
+        for (unsigned i = 0; i < options->connections; ++i) {
+            workers.emplace_back([&, i] {
+                RunConnection(*options, i, deadline, stats);
+            });
+        }
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started_at;
+
+    std::cout << std::left << std::setw(8) << "route" << std::right
+        << std::setw(10) << "requests" << std::setw(12) << "req/s"
+        << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "p999 ms" << "\n";
+    Report("join", stats.join, elapsed);
+    Report("action", stats.action, elapsed);
+    Report("state", stats.state, elapsed);
+    std::cout << "errors: " << stats.errors.load() << "\n";
+
+    return stats.errors.load() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,70 +1,291 @@
 
 #include "application.h"
+#include "sharding.h"
+#include "state_file.h"
 #include <random>
 #include <boost/json.hpp>
+#include <boost/system/system_error.hpp>
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
 #include <pqxx/pqxx>
+#include <iostream>
+#include <cstring>
+#include <unordered_set>
 
 namespace app {
 
     namespace {
 
-        std::string GenerateToken() {
-            std::random_device rd;
-            std::mt19937_64 gen1(rd());
-            std::mt19937_64 gen2(rd());
-            std::uniform_int_distribution<uint64_t> dist;
+        constexpr double MAX_RETIREMENT_SECONDS = 1e9;
+        constexpr double ITEM_COLLISION_RADIUS = 0.3;
+        constexpr double OFFICE_COLLISION_RADIUS = 0.55;
 
-            uint64_t part1 = dist(gen1);
-            uint64_t part2 = dist(gen2);
+        std::string GenerateToken(uint8_t shard) {
+            // Seeded once per thread from random_device, never from --random-seed.
+            thread_local util::Xoshiro256 gen{ (uint64_t{ std::random_device{}() } << 32) ^ std::random_device{}() };
 
-            std::stringstream ss;
-            ss << std::hex << std::setfill('0')
-                << std::setw(16) << part1
-                << std::setw(16) << part2;
-            return ss.str();
+            model::Token token;
+            // The all-zero token is the index's empty-slot marker.
+            while (token.Empty()) {
+                token = sharding::ShardMap::WithShard({ gen(), gen() }, shard);
+            }
+            return token.ToString();
         }
 
+        // Shared by the caller and the tasks it posts. Whoever runs first claims the
+        // next map index, so the caller never waits on a task that has not started.
+        struct PerMapJob {
+            const std::function<void(size_t)>* fn;
+            size_t count;
+            std::atomic<size_t> next{ 0 };
+            std::mutex mutex;
+            std::condition_variable done_cv;
+            size_t done = 0;
+            std::exception_ptr error;
+
+            void Drain() {
+                for (size_t i; (i = next.fetch_add(1)) < count;) {
+                    std::exception_ptr task_error;
+                    try {
+                        (*fn)(i);
+                    }
+                    catch (...) {
+                        task_error = std::current_exception();
+                    }
+
+                    std::lock_guard lock{ mutex };
+                    if (task_error && !error) {
+                        error = task_error;
+                    }
+                    if (++done == count) {
+                        done_cv.notify_all();
+                    }
+                }
+            }
+        };
+
     }
 
     void Application::InitializeCollisionDetectors() {
+        collision_detectors_.clear();
+        collision_detectors_.reserve(game_.GetMaps().size());
         for (const auto& map : game_.GetMaps()) {
-            collision_detectors_[map.GetId()] =
-                std::make_unique<model::CollisionDetector>(map);
+            collision_detectors_.emplace_back(map);
         }
     }
 
     void Application::Tick(std::chrono::milliseconds delta) {
-        double delta_seconds = delta.count() / 1000.0;
-        UpdateGameState(delta_seconds);
-
-        GenerateLootItems();
-        CheckPlayerRetirement(delta);
+        Step(delta, { .generate_loot = true, .retire_players = true, .save_state = true });
     }
 
     void Application::UpdateGameState(double delta_time_seconds) {
-        for (auto& dog : game_.GetDogs()) {
-            auto start_pos = dog.GetPosition();
-            MoveDog(dog, delta_time_seconds);
-            auto end_pos = dog.GetPosition();
+        Step(std::chrono::duration<double>{ delta_time_seconds }, {});
+    }
+
+    void Application::Step(std::chrono::duration<double> delta, StepPhases phases) {
+        const auto started_at = std::chrono::steady_clock::now();
+        const double delta_seconds = delta.count();
+        const auto delta_ms = std::chrono::duration_cast<std::chrono::milliseconds>(delta);
+        ApplyQueuedActions();
+        AdvanceDogs(delta_seconds);
+
+        RunPerMap([this, delta_seconds](size_t map_index) {
+            UpdateMapState(map_index, delta_seconds);
+        });
+        if (phases.generate_loot) {
+            // Loot ids come from one counter shared by all maps, so maps draw theirs in
+            // map order rather than in whatever order the workers get to them; otherwise
+            // a seeded run would not replay.
+            for (size_t map_index = 0; map_index < game_.GetMaps().size(); ++map_index) {
+                GenerateLootItems(map_index, delta_ms);
+            }
+        }
 
-            ProcessDogCollisions(dog, start_pos, end_pos);
+        MarkStoppedDogsIdle();
+        EmitCollisionEvents();
+        if (phases.retire_players) {
+            CheckPlayerRetirement();
+        }
+        PublishSnapshots();
+        if (phases.save_state) {
+            MaybeSaveState(delta_ms);
         }
+        metrics_.RecordTick(std::chrono::steady_clock::now() - started_at);
     }
 
-    void Application::MoveDog(model::Dog& dog, double delta_time) {
-        if (dog.GetVelocity().vx == 0 && dog.GetVelocity().vy == 0) {
+    void Application::InitializeRandom() {
+        uint64_t seed = random_seed_;
+        map_random_.clear();
+        for (size_t i = 0; i < game_.GetMaps().size(); ++i) {
+            const uint64_t spawn_seed = util::SplitMix64(seed);
+            const uint64_t loot_seed = util::SplitMix64(seed);
+            map_random_.push_back({ util::Xoshiro256{ spawn_seed }, util::Xoshiro256{ loot_seed } });
+        }
+    }
+
+    void Application::InitializeLootGenerators() {
+        loot_generators_.clear();
+        for (const auto& map : game_.GetMaps()) {
+            const auto& config = map.GetLootGeneratorConfig().value_or(game_.GetDefaultLootGeneratorConfig());
+            const auto period = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::duration<double>{ config.period_seconds });
+            loot_generators_.emplace_back(period, config.probability);
+        }
+    }
+
+    void Application::InitializeSnapshots() {
+        snapshots_.clear();
+        for (size_t i = 0; i < game_.GetMaps().size(); ++i) {
+            snapshots_.push_back(std::make_unique<SnapshotSlot>());
+            RebuildSnapshot(i);
+        }
+    }
+
+    void Application::PublishSnapshots() {
+        auto timer = metrics_.Time(metrics::Phase::Snapshot);
+        ++tick_count_;
+
+        map_players_.resize(game_.GetMaps().size());
+        RunPerMap([this](size_t map_index) {
+            CollectMapPlayers(map_index, map_players_[map_index]);
+            StoreSnapshot(map_index, map_players_[map_index]);
+        });
+
+        if (snapshot_listener_) {
+            for (size_t map_index = 0; map_index < snapshots_.size(); ++map_index) {
+                auto published = snapshots_[map_index]->current.load();
+                snapshot_listener_(map_index, { published, &published->snapshot });
+            }
+        }
+    }
+
+    std::shared_ptr<const MapSnapshot> Application::GetMapSnapshot(model::MapIndex map_index) const {
+        if (map_index >= snapshots_.size()) {
+            return nullptr;
+        }
+        auto published = snapshots_[map_index]->current.load();
+        return { published, &published->snapshot };
+    }
+
+    void Application::StoreSnapshot(size_t map_index, const std::vector<const model::Player*>& players) {
+        auto& slot = *snapshots_[map_index];
+        // Read before building, so a change made meanwhile leaves the result stale.
+        const uint64_t version = slot.version.load();
+        slot.current.store(std::make_shared<const PublishedSnapshot>(PublishedSnapshot{
+            version, BuildMapSnapshot(game_, map_index, players, tick_count_.load()) }));
+    }
+
+    void Application::RebuildSnapshot(size_t map_index) {
+        std::vector<const model::Player*> players;
+        CollectMapPlayers(map_index, players);
+        StoreSnapshot(map_index, players);
+    }
+
+    void Application::MarkSnapshotDirty(size_t map_index) {
+        auto& slot = *snapshots_[map_index];
+        slot.version.fetch_add(1);
+        if (!game_task_poster_) {
+            RebuildSnapshot(map_index);
             return;
         }
+        // One rebuild in flight per map; changes made before it runs are folded in,
+        // and a tick publishing first makes it a no-op.
+        if (!slot.rebuild_pending.exchange(true)) {
+            game_task_poster_([this, map_index] {
+                auto& slot = *snapshots_[map_index];
+                slot.rebuild_pending.store(false);
+                if (slot.current.load()->version != slot.version.load()) {
+                    RebuildSnapshot(map_index);
+                }
+            });
+        }
+    }
+
+    void Application::CollectMapPlayers(size_t map_index, std::vector<const model::Player*>& players) const {
+        const auto& handles = game_.GetMapPlayers(static_cast<model::MapIndex>(map_index));
+        players.clear();
+        players.reserve(handles.size());
+        for (const auto handle : handles) {
+            players.push_back(game_.FindPlayer(handle));
+        }
+    }
 
-        auto map_id = dog.GetMapId();
-        auto it = collision_detectors_.find(map_id);
-        if (it == collision_detectors_.end()) {
+    void Application::AdvanceDogs(double delta_time_seconds) {
+        auto timer = metrics_.Time(metrics::Phase::Movement);
+        auto& motion = game_.GetDogMotion();
+        tick_start_x_.assign(motion.x.begin(), motion.x.end());
+        tick_start_y_.assign(motion.y.begin(), motion.y.end());
+
+        needs_scalar_move_.resize(motion.Size());
+        motion.Advance(delta_time_seconds, needs_scalar_move_);
+
+        map_stopped_dogs_.resize(game_.GetMaps().size());
+        map_collision_events_.resize(game_.GetMaps().size());
+        map_dog_slots_.resize(game_.GetMaps().size());
+        for (auto& slots : map_dog_slots_) {
+            slots.clear();
+        }
+        for (size_t slot = 0; slot < motion.Size(); ++slot) {
+            map_dog_slots_[motion.map_index[slot]].push_back(slot);
+        }
+    }
+
+    void Application::UpdateMapState(size_t map_index, double delta_time_seconds) {
+        auto timer = metrics_.Time(metrics::Phase::Collision);
+        map_stopped_dogs_[map_index].clear();
+        auto& events = map_collision_events_[map_index];
+        events.clear();
+        auto& dogs = game_.GetDogs();
+        for (size_t slot : map_dog_slots_[map_index]) {
+            auto& dog = dogs[slot];
+            if (needs_scalar_move_[slot]) {
+                MoveDog(dog, delta_time_seconds);
+            }
+
+            GatherCollisionEvents(dog, { tick_start_x_[slot], tick_start_y_[slot] }, dog.GetPosition(), events);
+        }
+        ResolveCollisionEvents(map_index, events);
+    }
+
+    void Application::RunPerMap(const std::function<void(size_t map_index)>& fn) {
+        const size_t map_count = game_.GetMaps().size();
+        if (!task_poster_ || map_count < 2) {
+            for (size_t i = 0; i < map_count; ++i) {
+                fn(i);
+            }
+            return;
+        }
+
+        auto job = std::make_shared<PerMapJob>();
+        job->fn = &fn;
+        job->count = map_count;
+
+        const size_t helpers = std::min<size_t>(map_count, std::max(1u, std::thread::hardware_concurrency())) - 1;
+        for (size_t i = 0; i < helpers; ++i) {
+            task_poster_([job] {
+                job->Drain();
+            });
+        }
+        job->Drain();
+
+        std::unique_lock lock{ job->mutex };
+        job->done_cv.wait(lock, [&job] {
+            return job->done == job->count;
+        });
+        if (job->error) {
+            std::rethrow_exception(job->error);
+        }
+    }
+
+    void Application::MoveDog(model::Dog& dog, double delta_time) {
+        if (dog.GetVelocity().vx == 0 && dog.GetVelocity().vy == 0) {
             return;
         }
 
-        auto& detector = *it->second;
+        const auto& detector = collision_detectors_[dog.GetMapIndex()];
         auto current_pos = dog.GetPosition();
         auto velocity = dog.GetVelocity();
 
@@ -74,76 +295,111 @@ namespace app {
 
         if (movement_result.collision_occurred) {
             dog.SetVelocity({ 0.0, 0.0 });
+            map_stopped_dogs_[dog.GetMapIndex()].push_back(dog.GetId());
+        }
+        else {
+            game_.GetDogMotion().SetBounds(dog.GetMotionSlot(),
+                detector.GetMotionBounds(dog.GetPosition(), dog.GetVelocity()));
         }
     }
 
-    void Application::ProcessDogCollisions(model::Dog& dog,
+    void Application::GatherCollisionEvents(const model::Dog& dog,
         const model::Position& start_pos,
-        const model::Position& end_pos) {
-        const auto* map = FindMap(dog.GetMapId());
-        if (!map) return;
-
-        std::vector<CollisionEvent> events;
-
-        for (const auto& loot : map->GetLootItems()) {
-            auto collision_time = FindCollisionTime(start_pos, end_pos,
-                loot.GetPosition(), 0.3);
-
-            if (collision_time.has_value()) {
-                events.push_back({
-                    CollisionEvent::ITEM_PICKUP,
-                    collision_time.value(),
-                    dog.GetId(),
-                    *loot.GetId(),
-                    loot.GetType()
-                    });
-            }
-        }
-
-        for (const auto& office : map->GetOffices()) {
-            auto office_pos = model::Position{
-                static_cast<double>(office.GetPosition().x),
-                static_cast<double>(office.GetPosition().y)
-            };
-
-            auto collision_time = FindCollisionTime(start_pos, end_pos,
-                office_pos, 0.55);
+        const model::Position& end_pos,
+        std::vector<CollisionEvent>& events) {
+        const auto& map = game_.GetMap(dog.GetMapIndex());
+
+        map.ForEachLootCandidate(start_pos, end_pos, ITEM_COLLISION_RADIUS,
+            [&](const model::LootItem& loot) {
+                auto collision_time = FindCollisionTime(start_pos, end_pos,
+                    loot.GetPosition(), ITEM_COLLISION_RADIUS);
+
+                if (collision_time.has_value()) {
+                    events.push_back({
+                        CollisionEvent::ITEM_PICKUP,
+                        collision_time.value(),
+                        dog.GetId(),
+                        *loot.GetId(),
+                        loot.GetType()
+                        });
+                }
+            });
+
+        map.ForEachOfficeCandidate(start_pos, end_pos, OFFICE_COLLISION_RADIUS,
+            [&](const model::Office& office) {
+                auto office_pos = model::Position{
+                    static_cast<double>(office.GetPosition().x),
+                    static_cast<double>(office.GetPosition().y)
+                };
+
+                auto collision_time = FindCollisionTime(start_pos, end_pos,
+                    office_pos, OFFICE_COLLISION_RADIUS);
+
+                if (collision_time.has_value()) {
+                    events.push_back({
+                        CollisionEvent::OFFICE_RETURN,
+                        collision_time.value(),
+                        dog.GetId(),
+                        std::nullopt,
+                        std::nullopt
+                        });
+                }
+            });
+    }
 
-            if (collision_time.has_value()) {
-                events.push_back({
-                    CollisionEvent::OFFICE_RETURN,
-                    collision_time.value(),
-                    dog.GetId(),
-                    std::nullopt,
-                    std::nullopt
-                    });
+    // Every dog on the map moves over the same tick, so timestamps compare across
+    // dogs: the first dog to reach an item gets it, and ties go to the lower dog id.
+    // A pickup that finds the item gone or the bag full becomes an ITEM_SKIP.
+    void Application::ResolveCollisionEvents(size_t map_index, std::vector<CollisionEvent>& events) {
+        std::sort(events.begin(), events.end(), [](const CollisionEvent& a, const CollisionEvent& b) {
+            return std::tie(a.timestamp, a.dog_id, a.type, a.item_id)
+                < std::tie(b.timestamp, b.dog_id, b.type, b.item_id);
+        });
+
+        auto& map = game_.GetMap(static_cast<model::MapIndex>(map_index));
+        for (auto& event : events) {
+            auto* dog = game_.FindDog(event.dog_id);
+            if (!dog) {
+                continue;
             }
-        }
-
-        std::sort(events.begin(), events.end(),
-            [](const auto& a, const auto& b) { return a.timestamp < b.timestamp; });
 
-        for (const auto& event : events) {
             if (event.type == CollisionEvent::ITEM_PICKUP) {
-                if (!dog.IsBagFull()) {
-                    auto* item = const_cast<model::Map*>(map)->FindLootItem(model::LootItem::Id{ event.item_id.value() });
-                    if (item) {
-                        dog.AddToBag(*item);
-                        const_cast<model::Map*>(map)->RemoveLootItem(item->GetId());
-                    }
-                }
-                else {
+                const model::LootItem::Id item_id{ event.item_id.value() };
+                const auto* item = map.FindLootItem(item_id);
+                if (!item || dog->IsBagFull()) {
+                    event.type = CollisionEvent::ITEM_SKIP;
+                    continue;
                 }
+                dog->AddToBag(*item);
+                map.RemoveLootItem(item_id);
             }
             else if (event.type == CollisionEvent::OFFICE_RETURN) {
-                for (const auto& bag_item : dog.GetBag()) {
-                    dog.AddScore(bag_item.value);
+                for (const auto& bag_item : dog->GetBag()) {
+                    dog->AddScore(bag_item.value);
                 }
-                dog.ClearBag();
+                dog->ClearBag();
             }
         }
     }
 
+    void Application::EmitCollisionEvents() {
+        uint64_t counts[3] = {};
+        for (size_t map_index = 0; map_index < map_collision_events_.size(); ++map_index) {
+            const auto& events = map_collision_events_[map_index];
+            if (events.empty()) {
+                continue;
+            }
+            for (const auto& event : events) {
+                ++counts[event.type];
+            }
+            if (collision_listener_) {
+                collision_listener_(map_index, events);
+            }
+        }
+        metrics_.CountCollisionEvents(counts[CollisionEvent::ITEM_PICKUP], counts[CollisionEvent::OFFICE_RETURN],
+            counts[CollisionEvent::ITEM_SKIP]);
+    }
+
     std::optional<double> Application::FindCollisionTime(const model::Position& start_pos,
         const model::Position& end_pos,
         const model::Position& target_pos,
@@ -197,80 +453,72 @@ namespace app {
         return distance_to_collision / path_length;
     }
 
-    const model::LootItem* Application::FindLootItem(const model::Map& map, int item_id) {
-        for (const auto& loot : map.GetLootItems()) {
-            if (*loot.GetId() == item_id) {
-                return &loot;
-            }
+    // The generator caps loot at one item per dog on the map, which keeps the
+    // spatial index and so the collision pass bounded by the player count.
+    void Application::GenerateLootItems(size_t map_index, std::chrono::milliseconds delta) {
+        auto timer = metrics_.Time(metrics::Phase::LootGeneration);
+        auto& map = game_.GetMap(static_cast<model::MapIndex>(map_index));
+        const auto& loot_types = map.GetLootTypes();
+        const auto looters = static_cast<unsigned>(map_dog_slots_[map_index].size());
+        const unsigned count = loot_generators_[map_index].Generate(
+            delta, static_cast<unsigned>(map.GetLootItems().size()), looters);
+        if (loot_types.empty()) {
+            return;
         }
-        return nullptr;
-    }
 
-    void Application::GenerateLootItems() {
-        static int next_loot_id = 0;
-
-        for (auto& map : const_cast<model::Game&>(game_).GetMaps()) {
-            if (map.GetLootItems().empty()) {
-                for (int i = 0; i < 5; ++i) {
-                    model::LootItem item(
-                        model::LootItem::Id{ next_loot_id++ },
-                        1, 
-                        10.0,
-                        { 10.0 + i * 5.0, 10.0 }
-                    );
-                    const_cast<model::Map&>(map).AddLootItem(std::move(item));
-                }
-            }
+        auto& gen = map_random_[map_index].loot;
+        std::uniform_int_distribution<size_t> type_dist(0, loot_types.size() - 1);
+        for (unsigned i = 0; i < count; ++i) {
+            const size_t type = type_dist(gen);
+            map.AddLootItem(model::LootItem{
+                model::LootItem::Id{ next_loot_id_++ },
+                static_cast<int>(type),
+                loot_types[type].value,
+                map.GetRandomRoadPosition(gen)
+            });
         }
     }
 
     std::optional<Application::JoinGameResult> Application::JoinGame(const std::string& user_name, const std::string& map_id) {
-        model::Map::Id map_id_obj{ map_id };
-        const auto* map = game_.FindMap(map_id_obj);
-        if (!map) {
+        const auto map_index = game_.FindMapIndex(map_id);
+        if (!map_index) {
             return std::nullopt;
         }
+        const auto* map = &game_.GetMap(*map_index);
 
         if (user_name.empty()) {
             return std::nullopt;
         }
 
-        static uint32_t next_dog_id = 0;
-        model::Dog::Id dog_id{ model::Dog::Id::value_type{next_dog_id++} };
+        model::Dog::Id dog_id{ model::Dog::Id::ValueType{next_dog_id_++} };
 
         model::Position spawn_position;
         if (randomize_spawn_points_) {
-            spawn_position = map->GetRandomDogPosition();
+            spawn_position = map->GetRandomRoadPosition(map_random_[*map_index].spawn);
         }
         else {
             spawn_position = map->GetDefaultDogPosition();
         }
 
-        model::Dog dog{ dog_id, user_name, map_id_obj, spawn_position };
+        model::Dog dog{ dog_id, user_name, *map_index };
 
         dog.SetBagCapacity(map->GetBagCapacity());
 
-        game_.GetDogs().push_back(std::move(dog));
+        game_.AddDog(std::move(dog), spawn_position);
 
-        static uint32_t next_player_id = 0;
-        model::Player::Id player_id{ model::Player::Id::value_type{next_player_id++} };
-        std::string token = GenerateToken();
-
-        model::Player player{ player_id, user_name, dog_id, map_id_obj, token };
-        game_.GetPlayers().push_back(std::move(player));
-
-        auto& players = game_.GetPlayers();
-        auto& dogs = game_.GetDogs();
+        model::Player::Id player_id{ model::Player::Id::ValueType{next_player_id_++} };
+        std::string token = GenerateToken(token_shard_);
 
-        game_.GetTokenToPlayerIndex()[token] = players.size() - 1;
-        game_.GetPlayerIdToIndex()[player_id] = players.size() - 1;
-        game_.GetDogIdToIndex()[dog_id] = dogs.size() - 1;
+        model::Player player{ player_id, user_name, dog_id, *map_index, token };
+        game_.AddPlayer(std::move(player));
 
-        PlayerMetadata metadata;
+        // A new dog stands still, so its idle time starts at the join.
+        auto& metadata = player_metadata_[player_id];
         metadata.join_time = std::chrono::steady_clock::now();
-        metadata.idle_start_time = std::nullopt;
-        metadata.is_retired = false;
-        player_metadata_[player_id] = metadata;
+        MarkIdle(player_id, metadata, metadata.join_time);
+        dog_players_.insert_or_assign(dog_id, player_id);
+
+        MarkSnapshotDirty(*map_index);
 
         return JoinGameResult{ token, player_id };
     }
@@ -282,12 +530,7 @@ namespace app {
         }
 
         std::vector<const model::Player*> players_on_map;
-        for (const auto& p : game_.GetPlayers()) {
-            if (p.GetMapId() == player->GetMapId()) {
-                players_on_map.push_back(&p);
-            }
-        }
-
+        CollectMapPlayers(player->GetMapIndex(), players_on_map);
         return players_on_map;
     }
 
@@ -298,63 +541,169 @@ namespace app {
         }
 
         std::vector<const model::Player*> players_on_map;
-        for (const auto& p : game_.GetPlayers()) {
-            if (p.GetMapId() == player->GetMapId()) {
-                players_on_map.push_back(&p);
-            }
-        }
-
+        CollectMapPlayers(player->GetMapIndex(), players_on_map);
         return players_on_map;
     }
 
+    std::optional<PlayerMove> ParsePlayerMove(std::string_view move) noexcept {
+        if (move == "L") {
+            return PlayerMove::Left;
+        }
+        if (move == "R") {
+            return PlayerMove::Right;
+        }
+        if (move == "U") {
+            return PlayerMove::Up;
+        }
+        if (move == "D") {
+            return PlayerMove::Down;
+        }
+        if (move.empty()) {
+            return PlayerMove::Stop;
+        }
+        return std::nullopt;
+    }
+
     bool Application::SetPlayerAction(const model::Player& player, const std::string& move) {
-        auto* dog = FindDog(player.GetDogId());
-        if (!dog) {
+        auto parsed = ParsePlayerMove(move);
+        return parsed && SetPlayerAction(player, *parsed);
+    }
+
+    bool Application::SetPlayerAction(const model::Player& player, PlayerMove move) {
+        if (!ApplyPlayerAction(player, move, std::chrono::steady_clock::now())) {
             return false;
         }
 
-        const auto* map = FindMap(player.GetMapId());
-        if (!map) {
+        MarkSnapshotDirty(player.GetMapIndex());
+        return true;
+    }
+
+    bool Application::SetPlayerAction(model::Game::PlayerHandle player, PlayerMove move) {
+        const auto* found = game_.FindPlayer(player);
+        return found && SetPlayerAction(*found, move);
+    }
+
+    void Application::QueuePlayerAction(model::Game::PlayerHandle player, PlayerMove move) {
+        action_queue_.Push({ player, move, std::chrono::steady_clock::now() });
+    }
+
+    size_t Application::QueuePlayerActions(std::span<const TokenAction> actions, std::vector<size_t>& rejected) {
+        const auto received_at = std::chrono::steady_clock::now();
+        std::vector<QueuedAction> queued;
+        queued.reserve(actions.size());
+        for (size_t i = 0; i < actions.size(); ++i) {
+            if (auto handle = game_.FindPlayerHandleByToken(actions[i].auth_token)) {
+                queued.push_back({ *handle, actions[i].move, received_at });
+            }
+            else {
+                rejected.push_back(i);
+            }
+        }
+        action_queue_.PushAll(queued.begin(), queued.end());
+        return queued.size();
+    }
+
+    size_t Application::SetPlayerActions(std::span<const TokenAction> actions, std::vector<size_t>& rejected) {
+        const auto received_at = std::chrono::steady_clock::now();
+        std::vector<std::pair<size_t, const model::Player*>> found;
+        found.reserve(actions.size());
+        for (size_t i = 0; i < actions.size(); ++i) {
+            if (const auto* player = game_.FindPlayerByToken(actions[i].auth_token)) {
+                found.emplace_back(i, player);
+            }
+            else {
+                rejected.push_back(i);
+            }
+        }
+
+        size_t accepted = 0;
+        std::vector<bool> dirty_maps(game_.GetMaps().size());
+        for (const auto& [index, player] : found) {
+            if (ApplyPlayerAction(*player, actions[index].move, received_at)) {
+                dirty_maps[player->GetMapIndex()] = true;
+                ++accepted;
+            }
+            else {
+                rejected.push_back(index);
+            }
+        }
+        for (size_t map_index = 0; map_index < dirty_maps.size(); ++map_index) {
+            if (dirty_maps[map_index]) {
+                MarkSnapshotDirty(map_index);
+            }
+        }
+        std::sort(rejected.end() - (actions.size() - accepted), rejected.end());
+        return accepted;
+    }
+
+    void Application::ApplyQueuedActions() {
+        auto timer = metrics_.Time(metrics::Phase::Actions);
+        drained_actions_.clear();
+        action_queue_.Drain([this](QueuedAction&& action) {
+            drained_actions_.push_back(action);
+        });
+        if (drained_actions_.empty()) {
+            return;
+        }
+
+        // Newest first, so only the last move of each player is applied; a handle
+        // whose player has retired since no longer resolves.
+        ++action_batch_;
+        for (auto it = drained_actions_.rbegin(); it != drained_actions_.rend(); ++it) {
+            const size_t slot = it->player.index;
+            if (slot >= applied_action_batch_.size()) {
+                applied_action_batch_.resize(slot + 1, 0);
+            }
+            if (applied_action_batch_[slot] == action_batch_) {
+                continue;
+            }
+            applied_action_batch_[slot] = action_batch_;
+
+            if (const auto* player = game_.FindPlayer(it->player)) {
+                ApplyPlayerAction(*player, it->move, it->received_at);
+            }
+        }
+    }
+
+    bool Application::ApplyPlayerAction(const model::Player& player, PlayerMove move,
+        std::chrono::steady_clock::time_point received_at) {
+        auto* dog = FindDog(player.GetDogId());
+        if (!dog) {
             return false;
         }
 
-        double speed = GetDogSpeedForMap(player.GetMapId());
+        double speed = GetDogSpeedForMap(player.GetMapIndex());
         model::Velocity new_velocity{ 0.0, 0.0 };
-        model::Direction new_direction = model::Direction::North;
+        model::Direction new_direction = dog->GetDirection();
 
-        if (move == "L") {
+        switch (move) {
+        case PlayerMove::Left:
             new_velocity = { -speed, 0.0 };
             new_direction = model::Direction::West;
-        }
-        else if (move == "R") {
+            break;
+        case PlayerMove::Right:
             new_velocity = { speed, 0.0 };
             new_direction = model::Direction::East;
-        }
-        else if (move == "U") {
+            break;
+        case PlayerMove::Up:
             new_velocity = { 0.0, -speed };
             new_direction = model::Direction::North;
-        }
-        else if (move == "D") {
+            break;
+        case PlayerMove::Down:
             new_velocity = { 0.0, speed };
             new_direction = model::Direction::South;
-        }
-        else if (move == "") {
-            new_velocity = { 0.0, 0.0 };
-            new_direction = dog->GetDirection();
-        }
-        else {
-            return false;
+            break;
+        case PlayerMove::Stop:
+            break;
         }
 
         dog->SetVelocity(new_velocity);
         dog->SetDirection(new_direction);
 
         auto it = player_metadata_.find(player.GetId());
-        if (it != player_metadata_.end() && !it->second.is_retired) {
+        if (it != player_metadata_.end()) {
             if (new_velocity.vx == 0.0 && new_velocity.vy == 0.0) {
-                if (!it->second.idle_start_time.has_value()) {
-                    it->second.idle_start_time = std::chrono::steady_clock::now();
-                }
+                MarkIdle(player.GetId(), it->second, received_at);
             } else {
                 it->second.idle_start_time = std::nullopt;
             }
@@ -364,18 +713,7 @@ namespace app {
     }
 
     const model::Player* Application::FindPlayerByToken(const std::string& auth_token) {
-        const auto& index = game_.GetTokenToPlayerIndex();
-        auto it = index.find(auth_token);
-        if (it == index.end()) {
-            return nullptr;
-        }
-
-        const auto& players = game_.GetPlayers();
-        if (it->second >= players.size()) {
-            return nullptr;
-        }
-
-        return &players[it->second];
+        return game_.FindPlayerByToken(auth_token);
     }
 
     const model::Map* Application::FindMap(const model::Map::Id& id) const {
@@ -383,73 +721,78 @@ namespace app {
     }
 
     model::Dog* Application::FindDog(const model::Dog::Id& id) {
-        auto& index = game_.GetDogIdToIndex();
-        auto it = index.find(id);
-        if (it == index.end()) {
-            return nullptr;
-        }
-
-        auto& dogs = game_.GetDogs();
-        if (it->second >= dogs.size()) {
-            return nullptr;
-        }
+        return game_.FindDog(id);
+    }
 
-        return &dogs[it->second];
+    double Application::GetDogSpeedForMap(model::MapIndex map_index) const {
+        return game_.GetMap(map_index).GetDogSpeed();
     }
 
-    double Application::GetDogSpeedForMap(const model::Map::Id& map_id) const {
-        const auto* map = FindMap(map_id);
-        if (!map) {
-            return 1.0;
+    void Application::MarkIdle(model::Player::Id player_id, PlayerMetadata& metadata,
+        std::chrono::steady_clock::time_point since) {
+        if (metadata.idle_start_time) {
+            return;
+        }
+        metadata.idle_start_time = since;
+        // Longer than that is as good as never, and would overflow the clock.
+        if (dog_retirement_time_seconds_ > MAX_RETIREMENT_SECONDS) {
+            return;
+        }
+        const auto retirement_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>{ dog_retirement_time_seconds_ });
+        idle_deadlines_.push({ since + retirement_time, since, player_id });
+
+        // Players that stop and go again leave stale entries behind; rebuild once
+        // they outnumber the live ones.
+        if (idle_deadlines_.size() > 2 * player_metadata_.size() + 64) {
+            std::vector<IdleDeadline> live;
+            live.reserve(player_metadata_.size());
+            for (const auto& [id, entry] : player_metadata_) {
+                if (entry.idle_start_time) {
+                    live.push_back({ *entry.idle_start_time + retirement_time, *entry.idle_start_time, id });
+                }
+            }
+            idle_deadlines_ = decltype(idle_deadlines_){ std::greater<>{}, std::move(live) };
         }
-
-        return map->GetDogSpeed();
     }
 
-    void Application::CheckPlayerRetirement(std::chrono::milliseconds delta) {
-        auto now = std::chrono::steady_clock::now();
-        std::vector<model::Player::Id> players_to_retire;
-
-        for (auto& [player_id, metadata] : player_metadata_) {
-            if (metadata.is_retired) {
-                continue;
+    void Application::MarkStoppedDogsIdle() {
+        const auto now = std::chrono::steady_clock::now();
+        for (auto& stopped : map_stopped_dogs_) {
+            for (const auto& dog_id : stopped) {
+                const auto player = dog_players_.find(dog_id);
+                if (player == dog_players_.end()) {
+                    continue;
+                }
+                if (auto it = player_metadata_.find(player->second); it != player_metadata_.end()) {
+                    MarkIdle(player->second, it->second, now);
+                }
             }
+            stopped.clear();
+        }
+    }
 
-            auto* player = game_.FindPlayer(player_id);
-            if (!player) {
-                continue;
-            }
+    void Application::CheckPlayerRetirement() {
+        auto timer = metrics_.Time(metrics::Phase::Retirement);
+        if (idle_deadlines_.empty()) {
+            return;
+        }
 
-            auto* dog = FindDog(player->GetDogId());
-            if (!dog) {
-                continue;
-            }
+        const auto now = std::chrono::steady_clock::now();
+        while (!idle_deadlines_.empty() && idle_deadlines_.top().deadline <= now) {
+            const auto expired = idle_deadlines_.top();
+            idle_deadlines_.pop();
 
-            if (dog->GetVelocity().vx == 0.0 && dog->GetVelocity().vy == 0.0) {
-                if (!metadata.idle_start_time.has_value()) {
-                    metadata.idle_start_time = now;
-                } else {
-                    auto idle_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-                        now - metadata.idle_start_time.value()
-                    );
-                    double idle_seconds = idle_duration.count() / 1000.0;
-                    if (idle_seconds >= dog_retirement_time_seconds_) {
-                        players_to_retire.push_back(player_id);
-                    }
-                }
-            } else {
-                metadata.idle_start_time = std::nullopt;
+            auto it = player_metadata_.find(expired.player_id);
+            if (it != player_metadata_.end() && it->second.idle_start_time == expired.idle_start) {
+                RetirePlayer(expired.player_id);
             }
         }
-
-        for (const auto& player_id : players_to_retire) {
-            RetirePlayer(player_id);
-        }
     }
 
     void Application::RetirePlayer(model::Player::Id player_id) {
         auto it = player_metadata_.find(player_id);
-        if (it == player_metadata_.end() || it->second.is_retired) {
+        if (it == player_metadata_.end()) {
             return;
         }
 
@@ -470,40 +813,464 @@ namespace app {
         double play_time_seconds = play_duration.count() / 1000.0;
 
         if (retirement_callback_) {
+            auto timer = metrics_.Time(metrics::Phase::DbCallback);
             retirement_callback_(player->GetName(), dog->GetScore(), play_time_seconds);
         }
 
-        it->second.is_retired = true;
+        player_metadata_.erase(it);
 
-        auto& token_index = game_.GetTokenToPlayerIndex();
-        token_index.erase(player->GetToken());
+        const auto dog_id = dog->GetId();
+        dog_players_.erase(dog_id);
+        game_.RemovePlayer(player_id);
+        game_.RemoveDog(dog_id);
+    }
+
+    void Application::MaybeSaveState(std::chrono::milliseconds delta) {
+        if (!state_saver_ || state_save_period_.count() <= 0) {
+            return;
+        }
+        since_state_save_ += delta;
+        if (since_state_save_ < state_save_period_) {
+            return;
+        }
+        since_state_save_ = {};
 
-        auto& player_id_index = game_.GetPlayerIdToIndex();
-        player_id_index.erase(player_id);
+        std::string state;
+        {
+            // Only the copy is on the tick; the saver writes it out elsewhere.
+            auto timer = metrics_.Time(metrics::Phase::StateSave);
+            state = SaveState();
+        }
+        state_saver_(std::move(state));
+    }
 
-        auto& dog_id_index = game_.GetDogIdToIndex();
-        dog_id_index.erase(dog->GetId());
+    namespace {
 
-        auto& players = game_.GetPlayers();
-        players.erase(
-            std::remove_if(players.begin(), players.end(),
-                [player_id](const model::Player& p) { return p.GetId() == player_id; }),
-            players.end()
-        );
+        struct SavedLoot {
+            int id;
+            int type;
+            double value;
+            model::Position position;
+        };
+
+        struct SavedPlayer {
+            uint32_t player_id;
+            uint32_t dog_id;
+            std::string_view name;
+            model::Token token;
+            model::MapIndex map_index;
+            model::Position position;
+            model::Velocity velocity;
+            model::Direction direction;
+            int bag_capacity;
+            int score;
+            // [bag_begin, bag_end) in the restore's shared list of bag items.
+            size_t bag_begin;
+            size_t bag_end;
+            int64_t play_time_ms;
+            int64_t idle_ms;
+        };
+
+        constexpr size_t SAVED_PLAYER_SIZE_HINT = 128;
+        constexpr size_t SAVED_LOOT_SIZE = 32;
 
-        auto& dogs = game_.GetDogs();
-        dogs.erase(
-            std::remove_if(dogs.begin(), dogs.end(),
-                [dog_id = dog->GetId()](const model::Dog& d) { return d.GetId() == dog_id; }),
-            dogs.end()
-        );
+    }
+
+    std::string Application::SaveState() const {
+        using namespace state_file;
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+
+        const auto& maps = game_.GetMaps();
+        size_t loot_count = 0;
+        for (const auto& map : maps) {
+            loot_count += map.GetLootItems().size();
+        }
+
+        Writer out{ 64 + game_.GetPlayers().Size() * SAVED_PLAYER_SIZE_HINT + loot_count * SAVED_LOOT_SIZE };
+        out.Put(MAGIC[0]);
+        out.Put(MAGIC[1]);
+        out.Put(MAGIC[2]);
+        out.Put(MAGIC[3]);
+        out.Put(FORMAT_VERSION);
+        out.Put(tick_count_.load());
+        out.Put(next_dog_id_.load());
+        out.Put(next_player_id_.load());
+        out.Put(next_loot_id_.load());
+
+        out.Put(static_cast<uint32_t>(maps.size()));
+        for (const auto& map : maps) {
+            out.Bytes(*map.GetId());
+            out.Put(static_cast<uint32_t>(map.GetLootItems().size()));
+            for (const auto& loot : map.GetLootItems()) {
+                out.Put(*loot.GetId());
+                out.Put(loot.GetType());
+                out.Put(loot.GetValue());
+                out.Put(loot.GetPosition().x);
+                out.Put(loot.GetPosition().y);
+            }
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        struct Entry {
+            const model::Player* player;
+            const model::Dog* dog;
+            const PlayerMetadata* metadata;
+        };
+
+        std::vector<Entry> players;
+        players.reserve(game_.GetPlayers().Size());
+        for (const auto& player : game_.GetPlayers()) {
+            const auto it = player_metadata_.find(player.GetId());
+            if (it == player_metadata_.end()) {
+                continue;
+            }
+            if (const auto* dog = game_.FindDog(player.GetDogId())) {
+                players.push_back({ &player, dog, &it->second });
+            }
+        }
+
+        out.Put(static_cast<uint32_t>(players.size()));
+        for (const auto& [player, dog, metadata] : players) {
+            const auto token = model::Token::Parse(player->GetToken()).value_or(model::Token{});
+
+            out.Put(*player->GetId());
+            out.Put(*dog->GetId());
+            out.Bytes(player->GetName());
+            out.Put(token.hi);
+            out.Put(token.lo);
+            out.Put(static_cast<uint32_t>(dog->GetMapIndex()));
+            out.Put(dog->GetPosition().x);
+            out.Put(dog->GetPosition().y);
+            out.Put(dog->GetVelocity().vx);
+            out.Put(dog->GetVelocity().vy);
+            out.Put(static_cast<uint8_t>(dog->GetDirection()));
+            out.Put(dog->GetBagCapacity());
+            out.Put(dog->GetScore());
+            out.Put(static_cast<uint32_t>(dog->GetBag().size()));
+            for (const auto& item : dog->GetBag()) {
+                out.Put(item.id);
+                out.Put(item.type);
+                out.Put(item.value);
+            }
+            out.Put(static_cast<int64_t>(duration_cast<milliseconds>(now - metadata->join_time).count()));
+            out.Put(static_cast<int64_t>(metadata->idle_start_time
+                ? duration_cast<milliseconds>(now - *metadata->idle_start_time).count()
+                : -1));
+        }
+
+        return out.Take();
+    }
+
+    size_t Application::RestoreState(std::string_view state) {
+        using namespace state_file;
+
+        const bool has_loot = std::any_of(game_.GetMaps().begin(), game_.GetMaps().end(),
+            [](const model::Map& map) { return !map.GetLootItems().empty(); });
+        if (game_.GetPlayers().Size() != 0 || has_loot) {
+            throw std::invalid_argument("Game state can only be restored into an empty game");
+        }
+
+        // Everything is parsed and checked before the game is touched.
+        Reader in{ state };
+        if (in.Take(sizeof(MAGIC)) != std::string_view{ MAGIC, sizeof(MAGIC) }) {
+            throw std::invalid_argument("Not a game state file");
+        }
+        if (in.Get<uint32_t>() != FORMAT_VERSION) {
+            throw std::invalid_argument("Unsupported game state version");
+        }
+        const auto tick = in.Get<uint64_t>();
+        auto next_dog_id = in.Get<uint32_t>();
+        auto next_player_id = in.Get<uint32_t>();
+        auto next_loot_id = in.Get<int32_t>();
+
+        // Index in the file -> index in the game, nullopt for maps that are gone.
+        const auto map_count = in.Get<uint32_t>();
+        std::vector<std::optional<model::MapIndex>> map_indices;
+        std::vector<std::vector<SavedLoot>> loot(game_.GetMaps().size());
+        for (uint32_t i = 0; i < map_count; ++i) {
+            const auto map_index = game_.FindMapIndex(in.Bytes());
+            map_indices.push_back(map_index);
+
+            const auto count = in.Get<uint32_t>();
+            std::unordered_set<int> ids;
+            for (uint32_t j = 0; j < count; ++j) {
+                SavedLoot item;
+                item.id = in.Get<int32_t>();
+                item.type = in.Get<int32_t>();
+                item.value = in.Get<double>();
+                item.position.x = in.Get<double>();
+                item.position.y = in.Get<double>();
+                if (!ids.insert(item.id).second) {
+                    throw std::invalid_argument("Duplicate loot item in game state");
+                }
+                next_loot_id = std::max(next_loot_id, item.id + 1);
+                if (map_index) {
+                    loot[*map_index].push_back(item);
+                }
+            }
+        }
+
+        // A player record takes at least 100 bytes, which bounds the reservation
+        // for a corrupt count.
+        const auto player_count = in.Get<uint32_t>();
+        const size_t expected_players = std::min<size_t>(player_count, state.size() / 100);
+        std::vector<SavedPlayer> players;
+        std::vector<model::BagItem> bags;
+        std::vector<uint32_t> player_ids;
+        std::vector<uint32_t> dog_ids;
+        std::vector<std::pair<uint64_t, uint64_t>> tokens;
+        players.reserve(expected_players);
+        player_ids.reserve(expected_players);
+        dog_ids.reserve(expected_players);
+        tokens.reserve(expected_players);
+        for (uint32_t i = 0; i < player_count; ++i) {
+            SavedPlayer player;
+            player.player_id = in.Get<uint32_t>();
+            player.dog_id = in.Get<uint32_t>();
+            player.name = in.Bytes();
+            const auto token_bytes = in.Take(2 * sizeof(uint64_t));
+            std::memcpy(&player.token.hi, token_bytes.data(), sizeof(uint64_t));
+            std::memcpy(&player.token.lo, token_bytes.data() + sizeof(uint64_t), sizeof(uint64_t));
+            const auto map = in.Get<uint32_t>();
+            player.position.x = in.Get<double>();
+            player.position.y = in.Get<double>();
+            player.velocity.vx = in.Get<double>();
+            player.velocity.vy = in.Get<double>();
+            const auto direction = in.Get<uint8_t>();
+            player.bag_capacity = in.Get<int32_t>();
+            player.score = in.Get<int32_t>();
+            const auto bag_count = in.Get<uint32_t>();
+            player.bag_begin = bags.size();
+            for (uint32_t j = 0; j < bag_count; ++j) {
+                model::BagItem item;
+                item.id = in.Get<int32_t>();
+                item.type = in.Get<int32_t>();
+                item.value = in.Get<double>();
+                bags.push_back(item);
+            }
+            player.bag_end = bags.size();
+            player.play_time_ms = in.Get<int64_t>();
+            player.idle_ms = in.Get<int64_t>();
+
+            if (map >= map_indices.size() || direction > static_cast<uint8_t>(model::Direction::East)
+                || player.token.Empty() || player.bag_capacity < 0) {
+                throw std::invalid_argument("Malformed player in game state");
+            }
+            player_ids.push_back(player.player_id);
+            dog_ids.push_back(player.dog_id);
+            tokens.emplace_back(player.token.hi, player.token.lo);
+            next_dog_id = std::max(next_dog_id, player.dog_id + 1);
+            next_player_id = std::max(next_player_id, player.player_id + 1);
+            if (!map_indices[map]) {
+                continue;
+            }
+            player.map_index = *map_indices[map];
+            player.direction = static_cast<model::Direction>(direction);
+            players.push_back(player);
+        }
+        if (!in.AtEnd()) {
+            throw std::invalid_argument("Trailing data in game state");
+        }
+
+        auto has_duplicates = [](auto& keys) {
+            std::sort(keys.begin(), keys.end());
+            return std::adjacent_find(keys.begin(), keys.end()) != keys.end();
+        };
+        if (has_duplicates(player_ids) || has_duplicates(dog_ids) || has_duplicates(tokens)) {
+            throw std::invalid_argument("Duplicate player in game state");
+        }
+
+        for (size_t map_index = 0; map_index < loot.size(); ++map_index) {
+            auto& map = game_.GetMap(static_cast<model::MapIndex>(map_index));
+            for (const auto& item : loot[map_index]) {
+                map.AddLootItem(model::LootItem{ model::LootItem::Id{ item.id }, item.type, item.value, item.position });
+            }
+        }
+
+        game_.Reserve(players.size());
+        player_metadata_.reserve(players.size());
+        dog_players_.reserve(players.size());
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto& saved : players) {
+            model::Dog dog{ model::Dog::Id{ saved.dog_id }, std::string(saved.name), saved.map_index };
+            dog.SetBagCapacity(saved.bag_capacity);
+            for (size_t i = saved.bag_begin; i < saved.bag_end; ++i) {
+                const auto& item = bags[i];
+                dog.AddToBag(model::LootItem{ model::LootItem::Id{ item.id }, item.type, item.value, {} });
+            }
+            dog.AddScore(saved.score);
+            dog.SetDirection(saved.direction);
+            game_.AddDog(std::move(dog), saved.position).SetVelocity(saved.velocity);
+
+            const model::Player::Id player_id{ saved.player_id };
+            game_.AddPlayer(model::Player{ player_id, std::string(saved.name), model::Dog::Id{ saved.dog_id },
+                saved.map_index, saved.token.ToString() });
+
+            auto& metadata = player_metadata_[player_id];
+            metadata.join_time = now - std::chrono::milliseconds{ saved.play_time_ms };
+            if (saved.idle_ms >= 0) {
+                MarkIdle(player_id, metadata, now - std::chrono::milliseconds{ saved.idle_ms });
+            }
+            else if (saved.velocity.vx == 0.0 && saved.velocity.vy == 0.0) {
+                MarkIdle(player_id, metadata, now);
+            }
+            dog_players_.insert_or_assign(model::Dog::Id{ saved.dog_id }, player_id);
+        }
+
+        tick_count_ = tick;
+        next_dog_id_ = next_dog_id;
+        next_player_id_ = next_player_id;
+        next_loot_id_ = next_loot_id;
+        for (size_t map_index = 0; map_index < game_.GetMaps().size(); ++map_index) {
+            MarkSnapshotDirty(map_index);
+        }
+        return players.size();
     }
 
     namespace db {
 
+        namespace {
+
+            // retired_players stores whole milliseconds; records are compared on that
+            // grid so the cache orders ties exactly like the table does.
+            int64_t PlayTimeMs(const RetiredPlayer& player) {
+                return std::llround(player.play_time_seconds * 1000.0);
+            }
+
+            // The queries sort names with COLLATE "C", which compares bytes like
+            // std::string does, and ids by their canonical text, which orders like uuid.
+            bool RanksBefore(const RetiredPlayer& lhs, const RetiredPlayer& rhs) {
+                if (lhs.score != rhs.score) {
+                    return lhs.score > rhs.score;
+                }
+                if (PlayTimeMs(lhs) != PlayTimeMs(rhs)) {
+                    return PlayTimeMs(lhs) < PlayTimeMs(rhs);
+                }
+                if (lhs.name != rhs.name) {
+                    return lhs.name < rhs.name;
+                }
+                return lhs.id < rhs.id;
+            }
+
+            // Random (version 4) UUID made here rather than by the table default, so the
+            // cache knows a record's id without reading it back.
+            std::string GenerateRecordId() {
+                thread_local util::Xoshiro256 gen{ (uint64_t{ std::random_device{}() } << 32) ^ std::random_device{}() };
+
+                const uint64_t hi = (gen() & ~uint64_t{ 0xF000 }) | 0x4000;
+                const uint64_t lo = (gen() & ~(uint64_t{ 0xC } << 60)) | (uint64_t{ 0x8 } << 60);
+                std::string id = model::Token{ hi, lo }.ToString();
+                for (const size_t dash : { 8, 13, 18, 23 }) {
+                    id.insert(dash, 1, '-');
+                }
+                return id;
+            }
+
+            RetiredPlayer ParseRecord(const pqxx::row& row) {
+                RetiredPlayer player;
+                player.name = row[0].as<std::string>();
+                player.score = row[1].as<int>();
+                int64_t play_time_ms = row[2].as<int64_t>();
+                player.play_time_seconds = play_time_ms / 1000.0;
+                player.id = row[3].as<std::string>();
+                return player;
+            }
+
+            // Prepared once per connection by Database::PrepareStatements.
+            constexpr const char* INSERT_RECORD = "insert_retired_player";
+            constexpr const char* SELECT_RECORDS = "select_records";
+            constexpr const char* SELECT_RECORDS_AFTER = "select_records_after";
+
+        }
+
+        void Leaderboard::Reset(std::vector<RetiredPlayer> top, bool complete) {
+            std::sort(top.begin(), top.end(), RanksBefore);
+            if (top.size() > capacity_) {
+                top.resize(capacity_);
+                complete = false;
+            }
+
+            std::unique_lock lock{mutex_};
+            records_ = std::move(top);
+            complete_ = complete;
+        }
+
+        void Leaderboard::Add(const RetiredPlayer& player) {
+            std::unique_lock lock{mutex_};
+            auto pos = std::upper_bound(records_.begin(), records_.end(), player, RanksBefore);
+            if (records_.size() >= capacity_) {
+                if (pos == records_.end()) {
+                    complete_ = false;
+                    return;
+                }
+                records_.pop_back();
+                complete_ = false;
+            }
+            records_.insert(pos, player);
+        }
+
+        Leaderboard::Page Leaderboard::GetPage(size_t start, size_t max_items) const {
+            std::shared_lock lock{mutex_};
+            Page page;
+            page.window_size = records_.size();
+            if (!records_.empty()) {
+                page.window_last = records_.back();
+            }
+
+            if (start < records_.size()) {
+                const size_t end = std::min(records_.size(), start + max_items);
+                page.records.assign(records_.begin() + start, records_.begin() + end);
+            }
+            page.complete = complete_ || start + max_items <= records_.size();
+            return page;
+        }
+
         void Database::Initialize() {
             CreateTableIfNotExists();
             CreateIndexes();
+            // The statements name the table, so they can only be prepared once it exists.
+            pool_.SetConnectionSetup(&Database::PrepareStatements);
+            LoadLeaderboard();
+        }
+
+        void Database::PrepareStatements(pqxx::connection& conn) {
+            conn.prepare(INSERT_RECORD,
+                "INSERT INTO retired_players (id, name, score, play_time_ms) VALUES ($1, $2, $3, $4)");
+            // (score, play_time_ms, name, id) is unique, so the cursor never skips a row
+            // that ties with the last cached one.
+            conn.prepare(SELECT_RECORDS, R"(
+                SELECT name, score, play_time_ms, id
+                FROM retired_players 
+                ORDER BY score DESC, play_time_ms ASC, name COLLATE "C" ASC, id ASC
+                LIMIT $1 OFFSET $2
+            )");
+            conn.prepare(SELECT_RECORDS_AFTER, R"(
+                SELECT name, score, play_time_ms, id
+                FROM retired_players 
+                WHERE score < $1
+                   OR (score = $1 AND (play_time_ms > $2 OR (play_time_ms = $2
+                       AND (name COLLATE "C" > $3 OR (name COLLATE "C" = $3 AND id > $4::uuid)))))
+                ORDER BY score DESC, play_time_ms ASC, name COLLATE "C" ASC, id ASC
+                LIMIT $5 OFFSET $6
+            )");
+        }
+
+        void Database::LoadLeaderboard() {
+            auto conn = pool_.GetConnection();
+            pqxx::read_transaction tx{*conn};
+
+            const size_t capacity = leaderboard_.GetCapacity();
+            auto result = tx.exec_prepared(SELECT_RECORDS, static_cast<int64_t>(capacity), int64_t{ 0 });
+
+            std::vector<RetiredPlayer> top;
+            top.reserve(result.size());
+            for (const auto& row : result) {
+                top.push_back(ParseRecord(row));
+            }
+
+            const bool complete = top.size() < capacity;
+            leaderboard_.Reset(std::move(top), complete);
         }
 
         void Database::CreateTableIfNotExists() {
@@ -528,14 +1295,17 @@ namespace app {
 
             try {
                 auto result = tx.query_value<int>(
-                    "SELECT COUNT(*) FROM pg_indexes WHERE schemaname = 'public' AND indexname = 'idx_retired_players_score_time_name'"
+                    "SELECT COUNT(*) FROM pg_indexes WHERE schemaname = 'public' AND indexname = 'idx_retired_players_rank'"
                 );
 
                 if (result == 0) {
+                    // Matches the ORDER BY of the records queries; replaces the index that
+                    // sorted names by the database collation and had no id.
                     tx.exec(R"(
-                        CREATE INDEX idx_retired_players_score_time_name 
-                        ON retired_players (score DESC, play_time_ms, name)
+                        CREATE INDEX idx_retired_players_rank 
+                        ON retired_players (score DESC, play_time_ms, name COLLATE "C", id)
                     )");
+                    tx.exec("DROP INDEX IF EXISTS idx_retired_players_score_time_name");
                 }
             } catch (const std::exception& e) {
             }
@@ -548,39 +1318,183 @@ namespace app {
             pqxx::work tx{*conn};
 
             int64_t play_time_ms = static_cast<int64_t>(play_time_seconds * 1000.0);
+            auto id = GenerateRecordId();
 
-            tx.exec_params(
-                "INSERT INTO retired_players (name, score, play_time_ms) VALUES ($1, $2, $3)",
-                name, score, play_time_ms
-            );
+            tx.exec_prepared(INSERT_RECORD, id, name, score, play_time_ms);
 
             tx.commit();
+            leaderboard_.Add({name, score, play_time_ms / 1000.0, std::move(id)});
         }
 
-        std::vector<RetiredPlayer> Database::GetRecords(int start, int max_items) {
+        void Database::AddRetiredPlayers(const std::vector<RetiredPlayer>& players) {
+            if (players.empty()) {
+                return;
+            }
+
             auto conn = pool_.GetConnection();
-            pqxx::read_transaction tx{*conn};
+            pqxx::work tx{*conn};
+
+            std::vector<std::string> ids;
+            ids.reserve(players.size());
+            std::string query = "INSERT INTO retired_players (id, name, score, play_time_ms) VALUES ";
+            for (size_t i = 0; i < players.size(); ++i) {
+                const auto& player = players[i];
+                int64_t play_time_ms = static_cast<int64_t>(player.play_time_seconds * 1000.0);
+                ids.push_back(player.id.empty() ? GenerateRecordId() : player.id);
+                if (i != 0) {
+                    query += ", ";
+                }
+                query += "(" + tx.quote(ids.back()) + ", " + tx.quote(player.name) + ", "
+                    + std::to_string(player.score) + ", " + std::to_string(play_time_ms) + ")";
+            }
+
+            tx.exec(query);
+            tx.commit();
+
+            for (size_t i = 0; i < players.size(); ++i) {
+                const auto& player = players[i];
+                int64_t play_time_ms = static_cast<int64_t>(player.play_time_seconds * 1000.0);
+                leaderboard_.Add({player.name, player.score, play_time_ms / 1000.0, std::move(ids[i])});
+            }
+        }
+
+        RetiredPlayerWriter::RetiredPlayerWriter(Database& database, metrics::Registry* metrics, size_t batch_size,
+            std::chrono::milliseconds flush_period, size_t max_pending)
+            : database_(database)
+            , metrics_(metrics)
+            , batch_size_(std::max<size_t>(1, batch_size))
+            , flush_period_(flush_period)
+            , max_pending_(std::max(batch_size_, max_pending))
+            , thread_([this] { Run(); }) {
+        }
+
+        RetiredPlayerWriter::~RetiredPlayerWriter() {
+            Stop();
+        }
+
+        void RetiredPlayerWriter::Enqueue(RetiredPlayer player) {
+            bool batch_ready;
+            {
+                std::lock_guard lock{mutex_};
+                queue_.push_back(std::move(player));
+                batch_ready = queue_.size() >= batch_size_;
+            }
+            if (batch_ready) {
+                cond_var_.notify_one();
+            }
+        }
+
+        void RetiredPlayerWriter::Stop() {
+            {
+                std::lock_guard lock{mutex_};
+                stopping_ = true;
+            }
+            cond_var_.notify_one();
+            if (thread_.joinable()) {
+                thread_.join();
+            }
+        }
+
+        void RetiredPlayerWriter::Run() {
+            std::vector<RetiredPlayer> batch;
+            std::unique_lock lock{mutex_};
+            while (true) {
+                cond_var_.wait_for(lock, flush_period_, [this] {
+                    return stopping_ || queue_.size() >= batch_size_;
+                });
+                const bool stopping = stopping_;
+
+                // Records from a failed flush stay at the front and are retried next round;
+                // while the database is unreachable the oldest are dropped beyond max_pending.
+                batch.insert(batch.end(), std::make_move_iterator(queue_.begin()),
+                    std::make_move_iterator(queue_.end()));
+                queue_.clear();
+                lock.unlock();
+
+                if (batch.size() > max_pending_) {
+                    const size_t excess = batch.size() - max_pending_;
+                    batch.erase(batch.begin(), batch.begin() + excess);
+                    Drop(excess);
+                }
+                // After Stop this is the last attempt. It cannot hang on a busy pool:
+                // GetConnection gives up after the pool's wait_timeout.
+                if (!batch.empty() && Flush(batch)) {
+                    batch.clear();
+                }
+
+                if (stopping) {
+                    Drop(batch.size());
+                    return;
+                }
+                lock.lock();
+            }
+        }
 
-            auto result = tx.exec_params(
-                R"(
-                    SELECT name, score, play_time_ms 
-                    FROM retired_players 
-                    ORDER BY score DESC, play_time_ms ASC, name ASC 
-                    LIMIT $1 OFFSET $2
-                )",
-                max_items, start
-            );
+        bool RetiredPlayerWriter::Flush(std::vector<RetiredPlayer>& batch) noexcept {
+            try {
+                database_.AddRetiredPlayers(batch);
+                return true;
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to write retired players: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "Failed to write retired players" << std::endl;
+            }
+            return false;
+        }
+
+        void RetiredPlayerWriter::Drop(size_t count) noexcept {
+            if (metrics_ && count != 0) {
+                metrics_->CountDroppedRetiredPlayers(count);
+            }
+        }
 
-            std::vector<RetiredPlayer> records;
-            records.reserve(result.size());
+        void Database::GetRecords(int start, int max_items, RecordsHandler handler) {
+            auto page = leaderboard_.GetPage(start, max_items);
+            if (page.complete) {
+                handler(nullptr, std::move(page.records));
+                return;
+            }
 
+            pool_.AsyncGetConnection([this, start, max_items, page = std::move(page), handler = std::move(handler)](
+                boost::system::error_code ec, ConnectionPool::ConnectionWrapper conn) mutable {
+                if (ec) {
+                    handler(std::make_exception_ptr(boost::system::system_error{ ec, "No free database connection" }), {});
+                    return;
+                }
+                std::vector<RetiredPlayer> records;
+                try {
+                    records = QueryRecords(*conn, start, max_items, std::move(page));
+                } catch (...) {
+                    conn.Release();
+                    handler(std::current_exception(), {});
+                    return;
+                }
+                conn.Release();
+                handler(nullptr, std::move(records));
+            });
+        }
+
+        std::vector<RetiredPlayer> Database::QueryRecords(pqxx::connection& conn, int start, int max_items,
+            Leaderboard::Page page) {
+            // Continue from the last cached record instead of OFFSETting from the top.
+            const size_t missing = max_items - page.records.size();
+            const size_t skip = start + page.records.size() - page.window_size;
+
+            pqxx::read_transaction tx{conn};
+
+            pqxx::result result;
+            if (page.window_last) {
+                const auto& last = *page.window_last;
+                result = tx.exec_prepared(SELECT_RECORDS_AFTER, last.score, PlayTimeMs(last), last.name, last.id,
+                    static_cast<int64_t>(missing), static_cast<int64_t>(skip));
+            } else {
+                result = tx.exec_prepared(SELECT_RECORDS, static_cast<int64_t>(missing), static_cast<int64_t>(skip));
+            }
+
+            auto records = std::move(page.records);
+            records.reserve(records.size() + result.size());
             for (const auto& row : result) {
-                RetiredPlayer player;
-                player.name = row[0].as<std::string>();
-                player.score = row[1].as<int>();
-                int64_t play_time_ms = row[2].as<int64_t>();
-                player.play_time_seconds = play_time_ms / 1000.0;
-                records.push_back(std::move(player));
+                records.push_back(ParseRecord(row));
             }
 
             return records;
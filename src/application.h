@@ -2,16 +2,28 @@
 #pragma once
 #include "model.h"
 #include "collision_detector.h"
+#include "loot_generator.h"
+#include "game_snapshot.h"
+#include "mpsc_queue.h"
+#include "metrics.h"
+#include "connection_pool.h"
 #include <chrono>
 #include <unordered_map>
 #include <memory>
 #include <optional>
+#include <exception>
 #include <functional>
 #include <pqxx/pqxx>
+#include <queue>
+#include <random>
+#include <span>
 #include <string>
 #include <vector>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <shared_mutex>
 
 namespace app {
 
@@ -27,16 +39,40 @@ namespace app {
     struct PlayerMetadata {
         std::chrono::steady_clock::time_point join_time;
         std::optional<std::chrono::steady_clock::time_point> idle_start_time;
-        bool is_retired = false;
+    };
+
+    enum class PlayerMove : uint8_t {
+        Stop,
+        Left,
+        Right,
+        Up,
+        Down,
+    };
+
+    // "L", "R", "U", "D" or "" (stop); nullopt for anything else.
+    std::optional<PlayerMove> ParsePlayerMove(std::string_view move) noexcept;
+
+    // One entry of a batched action request; auth_token is unvalidated client input.
+    struct TokenAction {
+        std::string_view auth_token;
+        PlayerMove move;
     };
 
     class Application {
     public:
-        Application(model::Game& game, bool randomize_spawn_points = false, double dog_retirement_time_seconds = 60.0)
+        // Spawn points and loot are drawn from per-map generators derived from
+        // random_seed; without one a seed is taken from random_device. Tokens never
+        // depend on it.
+        Application(model::Game& game, bool randomize_spawn_points = false, double dog_retirement_time_seconds = 60.0,
+            std::optional<uint64_t> random_seed = std::nullopt)
             : game_(game)
             , randomize_spawn_points_(randomize_spawn_points)
-            , dog_retirement_time_seconds_(dog_retirement_time_seconds) {
+            , dog_retirement_time_seconds_(dog_retirement_time_seconds)
+            , random_seed_(random_seed ? *random_seed : std::random_device{}()) {
             InitializeCollisionDetectors();
+            InitializeRandom();
+            InitializeLootGenerators();
+            InitializeSnapshots();
         }
 
         struct JoinGameResult {
@@ -48,11 +84,43 @@ namespace app {
         std::vector<const model::Player*> GetPlayers(const std::string& auth_token);
         std::vector<const model::Player*> GetGameState(const std::string& auth_token);
         bool SetPlayerAction(const model::Player& player, const std::string& move);
+        bool SetPlayerAction(const model::Player& player, PlayerMove move);
+        // False when the player has retired since the handle was looked up.
+        bool SetPlayerAction(model::Game::PlayerHandle player, PlayerMove move);
+
+        // Lock-free alternative to SetPlayerAction for auto-tick mode: callable from
+        // any thread, applied at the start of the next tick (last move per player wins).
+        // Only pushes the handle, which the tick resolves; take it from
+        // Game::FindPlayerHandleByToken, never from the player table.
+        void QueuePlayerAction(model::Game::PlayerHandle player, PlayerMove move);
+
+        // Batch forms of QueuePlayerAction and SetPlayerAction. Every token is
+        // resolved in one pass before any move is applied, and QueuePlayerActions
+        // publishes the found ones with a single queue push. The indices of unknown
+        // tokens are appended to rejected; the number of accepted actions is returned.
+        size_t QueuePlayerActions(std::span<const TokenAction> actions, std::vector<size_t>& rejected);
+        size_t SetPlayerActions(std::span<const TokenAction> actions, std::vector<size_t>& rejected);
+
+        // Last snapshot published for the map, by a tick or by the rebuild a join or
+        // a manual action posts to the game thread; until that lands the previous one
+        // is served. Never touches the game, so it is safe to call from any thread.
+        // Take the map index from Game::FindPlayerRefByToken.
+        std::shared_ptr<const MapSnapshot> GetMapSnapshot(model::MapIndex map_index) const;
+
+        // Called at the end of every tick with each map's freshly published snapshot.
+        void SetSnapshotListener(std::function<void(size_t map_index, std::shared_ptr<const MapSnapshot>)> listener) {
+            snapshot_listener_ = std::move(listener);
+        }
 
         void Tick(std::chrono::milliseconds delta);
+        // Moves the world without generating loot, retiring players or saving state.
         void UpdateGameState(double delta_time_seconds);
         const model::Player* FindPlayerByToken(const std::string& auth_token);
         bool ShouldRandomizeSpawnPoints() const { return randomize_spawn_points_; }
+        // Passing this back as random_seed replays the same spawns and loot.
+        uint64_t GetRandomSeed() const noexcept { return random_seed_; }
+        // Stamped into every new token, see sharding::ShardMap; 0 when not sharded.
+        void SetTokenShard(uint8_t shard) noexcept { token_shard_ = shard; }
         const model::Map* FindMap(const model::Map::Id& id) const;
         model::Dog* FindDog(const model::Dog::Id& id);
         model::Game& GetGame() { return game_; }
@@ -62,27 +130,170 @@ namespace app {
             retirement_callback_ = std::move(callback);
         }
 
+        metrics::Registry& GetMetrics() noexcept { return metrics_; }
+
+        // Players, dogs, bags, tokens and loot in the state_file format. Call it from
+        // the thread that runs ticks, or once ticking has stopped.
+        std::string SaveState() const;
+
+        // Loads a SaveState() result into a game without players or loot and returns
+        // the number of restored players. Throws std::invalid_argument on a malformed
+        // state, leaving the game untouched. Players on maps the config no longer has
+        // are dropped.
+        size_t RestoreState(std::string_view state);
+
+        // Every period of game time, Tick hands a fresh SaveState() to saver.
+        void SetStateSaver(std::chrono::milliseconds period, std::function<void(std::string state)> saver) {
+            state_save_period_ = period;
+            state_saver_ = std::move(saver);
+        }
+
+        // Called once per tick for each map with collisions, with its events in the
+        // order they were resolved; a lost or blocked pickup is reported as ITEM_SKIP.
+        void SetCollisionListener(std::function<void(size_t map_index, const std::vector<CollisionEvent>& events)> listener) {
+            collision_listener_ = std::move(listener);
+        }
+
+        // Lets Tick fan per-map work out to a thread pool; without a poster maps tick serially.
+        void SetTaskPoster(std::function<void(std::function<void()>)> poster) {
+            task_poster_ = std::move(poster);
+        }
+
+        // Runs work on the thread that owns the game, where ticks run too. Snapshot
+        // rebuilds after joins and manual actions go through it; without a poster they
+        // happen inline.
+        void SetGameTaskPoster(std::function<void(std::function<void()>)> poster) {
+            game_task_poster_ = std::move(poster);
+        }
+
     private:
         model::Game& game_;
         bool randomize_spawn_points_;
         double dog_retirement_time_seconds_;
-        std::unordered_map<model::Map::Id, std::unique_ptr<model::CollisionDetector>> collision_detectors_;
+        // Indexed by model::MapIndex, like every other per-map array here.
+        std::vector<model::CollisionDetector> collision_detectors_;
+        // Entries live from join to retirement.
         std::unordered_map<model::Player::Id, PlayerMetadata, util::TaggedHasher<model::Player::Id>> player_metadata_;
+        std::unordered_map<model::Dog::Id, model::Player::Id, util::TaggedHasher<model::Dog::Id>> dog_players_;
+
+        // One entry per idle period, ordered by the time it ends. An entry whose
+        // player has moved again or retired no longer matches its metadata and is
+        // dropped when it reaches the top.
+        struct IdleDeadline {
+            std::chrono::steady_clock::time_point deadline;
+            std::chrono::steady_clock::time_point idle_start;
+            model::Player::Id player_id;
+
+            bool operator>(const IdleDeadline& other) const noexcept {
+                return deadline > other.deadline;
+            }
+        };
+
+        std::priority_queue<IdleDeadline, std::vector<IdleDeadline>, std::greater<>> idle_deadlines_;
+        // Dogs MoveDog stopped at a road end during the tick, per map.
+        std::vector<std::vector<model::Dog::Id>> map_stopped_dogs_;
+        // Reused across ticks; after the map phase each holds the map's resolved events.
+        std::vector<std::vector<CollisionEvent>> map_collision_events_;
+        std::function<void(size_t, const std::vector<CollisionEvent>&)> collision_listener_;
         std::function<void(const std::string& name, int score, double play_time_seconds)> retirement_callback_;
+        std::function<void(std::function<void()>)> task_poster_;
+        std::function<void(std::function<void()>)> game_task_poster_;
+        std::atomic<int> next_loot_id_{ 0 };
+        std::atomic<uint32_t> next_dog_id_{ 0 };
+        std::atomic<uint32_t> next_player_id_{ 0 };
+
+        std::chrono::milliseconds state_save_period_{ 0 };
+        std::chrono::milliseconds since_state_save_{ 0 };
+        std::function<void(std::string)> state_saver_;
+
+        // Separate streams, so the loot sequence of a map does not shift with the
+        // number of joins on it.
+        struct MapRandom {
+            util::Xoshiro256 spawn;
+            util::Xoshiro256 loot;
+        };
+
+        uint64_t random_seed_;
+        uint8_t token_shard_ = 0;
+        std::vector<MapRandom> map_random_;
+        std::vector<loot_gen::LootGenerator> loot_generators_;
+        metrics::Registry metrics_;
+
+        std::vector<double> tick_start_x_;
+        std::vector<double> tick_start_y_;
+        std::vector<uint8_t> needs_scalar_move_;
+        std::vector<std::vector<size_t>> map_dog_slots_;
+
+        struct PublishedSnapshot {
+            uint64_t version;
+            MapSnapshot snapshot;
+        };
+
+        // version counts changes made to the map outside of a tick; a published
+        // snapshot is current while its version matches. Only the game thread
+        // publishes, readers just load current.
+        struct SnapshotSlot {
+            std::atomic<uint64_t> version{ 0 };
+            std::atomic<std::shared_ptr<const PublishedSnapshot>> current;
+            std::atomic<bool> rebuild_pending{ false };
+        };
+
+        std::vector<std::unique_ptr<SnapshotSlot>> snapshots_;
+        std::atomic<uint64_t> tick_count_{ 0 };
+        std::vector<std::vector<const model::Player*>> map_players_;
+        std::function<void(size_t, std::shared_ptr<const MapSnapshot>)> snapshot_listener_;
+
+        struct QueuedAction {
+            model::Game::PlayerHandle player;
+            PlayerMove move;
+            std::chrono::steady_clock::time_point received_at;
+        };
+
+        util::MpscQueue<QueuedAction> action_queue_;
+        std::vector<QueuedAction> drained_actions_;
+        // applied_action_batch_[slot] == action_batch_ marks a player already handled.
+        std::vector<uint64_t> applied_action_batch_;
+        uint64_t action_batch_ = 0;
 
         void InitializeCollisionDetectors();
+        void InitializeRandom();
+        void InitializeLootGenerators();
+        void InitializeSnapshots();
+        void PublishSnapshots();
+        void CollectMapPlayers(size_t map_index, std::vector<const model::Player*>& players) const;
+        void StoreSnapshot(size_t map_index, const std::vector<const model::Player*>& players);
+        void RebuildSnapshot(size_t map_index);
+        void MarkSnapshotDirty(size_t map_index);
+        // Tick and UpdateGameState differ only in which of these phases run.
+        struct StepPhases {
+            bool generate_loot = false;
+            bool retire_players = false;
+            bool save_state = false;
+        };
+        void Step(std::chrono::duration<double> delta, StepPhases phases);
+        void ApplyQueuedActions();
+        bool ApplyPlayerAction(const model::Player& player, PlayerMove move,
+            std::chrono::steady_clock::time_point received_at);
+        void AdvanceDogs(double delta_time_seconds);
+        void UpdateMapState(size_t map_index, double delta_time_seconds);
+        void RunPerMap(const std::function<void(size_t map_index)>& fn);
         void MoveDog(model::Dog& dog, double delta_time);
-        double GetDogSpeedForMap(const model::Map::Id& map_id) const;
+        double GetDogSpeedForMap(model::MapIndex map_index) const;
 
-        void ProcessDogCollisions(model::Dog& dog, const model::Position& start_pos,
-            const model::Position& end_pos);
+        void GatherCollisionEvents(const model::Dog& dog, const model::Position& start_pos,
+            const model::Position& end_pos, std::vector<CollisionEvent>& events);
+        void ResolveCollisionEvents(size_t map_index, std::vector<CollisionEvent>& events);
+        void EmitCollisionEvents();
         std::optional<double> FindCollisionTime(const model::Position& start_pos,
             const model::Position& end_pos,
             const model::Position& target_pos,
             double collision_distance);
-        const model::LootItem* FindLootItem(const model::Map& map, int item_id);
-        void GenerateLootItems();
-        void CheckPlayerRetirement(std::chrono::milliseconds delta);
+        void GenerateLootItems(size_t map_index, std::chrono::milliseconds delta);
+        void MarkIdle(model::Player::Id player_id, PlayerMetadata& metadata,
+            std::chrono::steady_clock::time_point since);
+        void MarkStoppedDogsIdle();
+        void CheckPlayerRetirement();
+        void MaybeSaveState(std::chrono::milliseconds delta);
         void RetirePlayer(model::Player::Id player_id);
     };
 
@@ -92,90 +303,99 @@ namespace app {
             std::string name;
             int score;
             double play_time_seconds;
+            // The row's UUID, assigned when the record is written; the last tiebreaker.
+            std::string id = {};
         };
 
-        class ConnectionPool {
-            using PoolType = ConnectionPool;
-            using ConnectionPtr = std::shared_ptr<pqxx::connection>;
-
+        // Top of the records table kept in memory, ordered like the records query:
+        // score DESC, play time ASC, name ASC by bytes, id ASC. Holds at most
+        // capacity entries.
+        class Leaderboard {
         public:
-            class ConnectionWrapper {
-            public:
-                ConnectionWrapper(std::shared_ptr<pqxx::connection>&& conn, PoolType& pool) noexcept
-                    : conn_{std::move(conn)}
-                    , pool_{&pool} {
-                }
-
-                ConnectionWrapper(const ConnectionWrapper&) = delete;
-                ConnectionWrapper& operator=(const ConnectionWrapper&) = delete;
-                ConnectionWrapper(ConnectionWrapper&&) = default;
-                ConnectionWrapper& operator=(ConnectionWrapper&&) = default;
-
-                pqxx::connection& operator*() const& noexcept {
-                    return *conn_;
-                }
-
-                pqxx::connection& operator*() const&& = delete;
-
-                pqxx::connection* operator->() const& noexcept {
-                    return conn_.get();
-                }
-
-                ~ConnectionWrapper() {
-                    if (conn_) {
-                        pool_->ReturnConnection(std::move(conn_));
-                    }
-                }
-
-            private:
-                std::shared_ptr<pqxx::connection> conn_;
-                PoolType* pool_;
+            struct Page {
+                std::vector<RetiredPlayer> records;
+                bool complete = true;
+                size_t window_size = 0;
+                std::optional<RetiredPlayer> window_last;
             };
 
-            template <typename ConnectionFactory>
-            ConnectionPool(size_t capacity, ConnectionFactory&& connection_factory) {
-                pool_.reserve(capacity);
-                for (size_t i = 0; i < capacity; ++i) {
-                    pool_.emplace_back(connection_factory());
-                }
-            }
+            explicit Leaderboard(size_t capacity) : capacity_(capacity) {}
 
-            ConnectionWrapper GetConnection() {
-                std::unique_lock lock{mutex_};
-                cond_var_.wait(lock, [this] {
-                    return used_connections_ < pool_.size();
-                });
-                return {std::move(pool_[used_connections_++]), *this};
-            }
+            void Reset(std::vector<RetiredPlayer> top, bool complete);
+            void Add(const RetiredPlayer& player);
+            size_t GetCapacity() const noexcept { return capacity_; }
 
-        private:
-            void ReturnConnection(ConnectionPtr&& conn) {
-                {
-                    std::lock_guard lock{mutex_};
-                    assert(used_connections_ != 0);
-                    pool_[--used_connections_] = std::move(conn);
-                }
-                cond_var_.notify_one();
-            }
+            // Page is incomplete when part of [start, start + max_items) lies past the
+            // cached window and may still exist in the table.
+            Page GetPage(size_t start, size_t max_items) const;
 
-            std::mutex mutex_;
-            std::condition_variable cond_var_;
-            std::vector<ConnectionPtr> pool_;
-            size_t used_connections_ = 0;
+        private:
+            size_t capacity_;
+            mutable std::shared_mutex mutex_;
+            std::vector<RetiredPlayer> records_;
+            bool complete_ = true;
         };
 
         class Database {
         public:
-            Database(ConnectionPool& pool) : pool_(pool) {}
+            Database(ConnectionPool& pool, size_t leaderboard_capacity = 10000)
+                : pool_(pool)
+                , leaderboard_(leaderboard_capacity) {
+            }
+
+            // error is set when no connection was free in time or the query failed.
+            using RecordsHandler = std::function<void(std::exception_ptr error, std::vector<RetiredPlayer> records)>;
 
             void Initialize();
             void AddRetiredPlayer(const std::string& name, int score, double play_time_seconds);
-            std::vector<RetiredPlayer> GetRecords(int start = 0, int max_items = 100);
+            void AddRetiredPlayers(const std::vector<RetiredPlayer>& players);
+            // Answers from the cached top inline; otherwise queries on a pool thread and
+            // calls handler there.
+            void GetRecords(int start, int max_items, RecordsHandler handler);
 
         private:
             ConnectionPool& pool_;
+            Leaderboard leaderboard_;
+            static void PrepareStatements(pqxx::connection& conn);
             void CreateTableIfNotExists();
             void CreateIndexes();
+            void LoadLeaderboard();
+            std::vector<RetiredPlayer> QueryRecords(pqxx::connection& conn, int start, int max_items,
+                Leaderboard::Page page);
+        };
+
+        // Write-behind queue for retired players. Enqueue never touches the database;
+        // a background thread flushes batches once batch_size records are waiting or
+        // flush_period has passed, and Stop() makes one last attempt at whatever is left.
+        // At most max_pending records wait for a retry; older ones are dropped and counted.
+        class RetiredPlayerWriter {
+        public:
+            RetiredPlayerWriter(Database& database, metrics::Registry* metrics = nullptr, size_t batch_size = 256,
+                std::chrono::milliseconds flush_period = std::chrono::milliseconds{ 500 },
+                size_t max_pending = 65536);
+            ~RetiredPlayerWriter();
+
+            RetiredPlayerWriter(const RetiredPlayerWriter&) = delete;
+            RetiredPlayerWriter& operator=(const RetiredPlayerWriter&) = delete;
+
+            void Enqueue(RetiredPlayer player);
+            void Stop();
+
+        private:
+            void Run();
+            bool Flush(std::vector<RetiredPlayer>& batch) noexcept;
+            void Drop(size_t count) noexcept;
+
+            Database& database_;
+            metrics::Registry* metrics_;
+            size_t batch_size_;
+            std::chrono::milliseconds flush_period_;
+            size_t max_pending_;
+            std::mutex mutex_;
+            std::condition_variable cond_var_;
+            std::vector<RetiredPlayer> queue_;
+            bool stopping_ = false;
+            std::thread thread_;
         };
 
     }
@@ -0,0 +1,297 @@
+#include "binary_state.h"
+
+#include <cmath>
+
+namespace app::binary {
+
+    namespace {
+
+        class Writer {
+        public:
+            explicit Writer(size_t size_hint) {
+                out_.reserve(size_hint);
+            }
+
+            void Byte(uint8_t value) {
+                out_.push_back(static_cast<char>(value));
+            }
+
+            void Varint(uint64_t value) {
+                while (value >= 0x80) {
+                    Byte(static_cast<uint8_t>(value | 0x80));
+                    value >>= 7;
+                }
+                Byte(static_cast<uint8_t>(value));
+            }
+
+            void Svarint(int64_t value) {
+                Varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+            }
+
+            void Fixed(double value) {
+                Svarint(std::llround(value * POSITION_SCALE));
+            }
+
+            void Bytes(std::string_view value) {
+                Varint(value.size());
+                out_.append(value);
+            }
+
+            void Header(MessageKind kind, uint64_t tick) {
+                Byte('G');
+                Byte('S');
+                Byte(FORMAT_VERSION);
+                Byte(static_cast<uint8_t>(kind));
+                Varint(tick);
+            }
+
+            std::string Take() {
+                return std::move(out_);
+            }
+
+        private:
+            std::string out_;
+        };
+
+        class Reader {
+        public:
+            explicit Reader(std::string_view in)
+                : in_(in) {
+            }
+
+            std::optional<uint8_t> Byte() {
+                if (pos_ >= in_.size()) {
+                    return std::nullopt;
+                }
+                return static_cast<uint8_t>(in_[pos_++]);
+            }
+
+            std::optional<uint64_t> Varint() {
+                uint64_t value = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                    auto byte = Byte();
+                    if (!byte) {
+                        return std::nullopt;
+                    }
+                    value |= static_cast<uint64_t>(*byte & 0x7F) << shift;
+                    if (!(*byte & 0x80)) {
+                        return value;
+                    }
+                }
+                return std::nullopt;
+            }
+
+            std::optional<int64_t> Svarint() {
+                auto value = Varint();
+                if (!value) {
+                    return std::nullopt;
+                }
+                return static_cast<int64_t>(*value >> 1) ^ -static_cast<int64_t>(*value & 1);
+            }
+
+            std::optional<double> Fixed() {
+                auto value = Svarint();
+                if (!value) {
+                    return std::nullopt;
+                }
+                return static_cast<double>(*value) / POSITION_SCALE;
+            }
+
+            std::optional<std::string> Bytes() {
+                auto size = Varint();
+                if (!size || *size > in_.size() - pos_) {
+                    return std::nullopt;
+                }
+                std::string value{ in_.substr(pos_, *size) };
+                pos_ += *size;
+                return value;
+            }
+
+            // Counts are bounded by the remaining input, so a corrupt count cannot
+            // trigger a huge reserve.
+            std::optional<uint64_t> Count() {
+                auto count = Varint();
+                if (!count || *count > in_.size() - pos_) {
+                    return std::nullopt;
+                }
+                return count;
+            }
+
+            bool AtEnd() const noexcept {
+                return pos_ == in_.size();
+            }
+
+        private:
+            std::string_view in_;
+            size_t pos_ = 0;
+        };
+
+        uint8_t EncodeDirection(model::Direction direction) {
+            switch (direction) {
+            case model::Direction::North:
+                return 0;
+            case model::Direction::South:
+                return 1;
+            case model::Direction::West:
+                return 2;
+            case model::Direction::East:
+                return 3;
+            }
+            return 0;
+        }
+
+        std::optional<model::Direction> DecodeDirection(uint8_t value) {
+            constexpr model::Direction directions[] = {
+                model::Direction::North, model::Direction::South, model::Direction::West, model::Direction::East
+            };
+            if (value >= std::size(directions)) {
+                return std::nullopt;
+            }
+            return directions[value];
+        }
+
+        bool DecodeDogs(Reader& reader, std::vector<DogState>& dogs) {
+            auto count = reader.Count();
+            if (!count) {
+                return false;
+            }
+            dogs.reserve(*count);
+            for (uint64_t i = 0; i < *count; ++i) {
+                auto id = reader.Varint();
+                auto x = reader.Fixed();
+                auto y = reader.Fixed();
+                auto vx = reader.Fixed();
+                auto vy = reader.Fixed();
+                auto dir_byte = reader.Byte();
+                auto dir = dir_byte ? DecodeDirection(*dir_byte) : std::nullopt;
+                auto score = reader.Varint();
+                auto bag_count = reader.Count();
+                if (!id || !x || !y || !vx || !vy || !dir || !score || !bag_count) {
+                    return false;
+                }
+
+                DogState dog{ model::Player::Id{ static_cast<uint32_t>(*id) }, {}, { *x, *y }, { *vx, *vy }, *dir, {},
+                    static_cast<int>(*score) };
+                dog.bag.reserve(*bag_count);
+                for (uint64_t j = 0; j < *bag_count; ++j) {
+                    auto item_id = reader.Varint();
+                    auto item_type = reader.Varint();
+                    if (!item_id || !item_type) {
+                        return false;
+                    }
+                    dog.bag.push_back({ static_cast<int>(*item_id), static_cast<int>(*item_type), 0.0 });
+                }
+                dogs.push_back(std::move(dog));
+            }
+            return true;
+        }
+
+        bool DecodeLoot(Reader& reader, std::vector<LootState>& loot) {
+            auto count = reader.Count();
+            if (!count) {
+                return false;
+            }
+            loot.reserve(*count);
+            for (uint64_t i = 0; i < *count; ++i) {
+                auto id = reader.Varint();
+                auto type = reader.Varint();
+                auto x = reader.Fixed();
+                auto y = reader.Fixed();
+                if (!id || !type || !x || !y) {
+                    return false;
+                }
+                loot.push_back({ model::LootItem::Id{ static_cast<int>(*id) }, static_cast<int>(*type), { *x, *y } });
+            }
+            return true;
+        }
+
+        bool DecodePlayers(Reader& reader, std::vector<DogState>& dogs) {
+            auto count = reader.Count();
+            if (!count) {
+                return false;
+            }
+            dogs.reserve(*count);
+            for (uint64_t i = 0; i < *count; ++i) {
+                auto id = reader.Varint();
+                auto name = reader.Bytes();
+                if (!id || !name) {
+                    return false;
+                }
+                dogs.push_back({ model::Player::Id{ static_cast<uint32_t>(*id) }, std::move(*name),
+                    {}, {}, model::Direction::North, {}, 0 });
+            }
+            return true;
+        }
+
+    }  // namespace
+
+    std::string EncodeState(const MapSnapshot& snapshot) {
+        Writer writer{ 16 + snapshot.dogs.size() * 24 + snapshot.loot.size() * 8 };
+        writer.Header(MessageKind::State, snapshot.tick);
+
+        writer.Varint(snapshot.dogs.size());
+        for (const auto& dog : snapshot.dogs) {
+            writer.Varint(*dog.player_id);
+            writer.Fixed(dog.position.x);
+            writer.Fixed(dog.position.y);
+            writer.Fixed(dog.speed.vx);
+            writer.Fixed(dog.speed.vy);
+            writer.Byte(EncodeDirection(dog.direction));
+            writer.Varint(static_cast<uint64_t>(dog.score));
+            writer.Varint(dog.bag.size());
+            for (const auto& item : dog.bag) {
+                writer.Varint(static_cast<uint64_t>(item.id));
+                writer.Varint(static_cast<uint64_t>(item.type));
+            }
+        }
+
+        writer.Varint(snapshot.loot.size());
+        for (const auto& loot : snapshot.loot) {
+            writer.Varint(static_cast<uint64_t>(*loot.id));
+            writer.Varint(static_cast<uint64_t>(loot.type));
+            writer.Fixed(loot.position.x);
+            writer.Fixed(loot.position.y);
+        }
+        return writer.Take();
+    }
+
+    std::string EncodePlayers(const MapSnapshot& snapshot) {
+        Writer writer{ 16 + snapshot.dogs.size() * 16 };
+        writer.Header(MessageKind::Players, snapshot.tick);
+
+        writer.Varint(snapshot.dogs.size());
+        for (const auto& dog : snapshot.dogs) {
+            writer.Varint(*dog.player_id);
+            writer.Bytes(dog.name);
+        }
+        return writer.Take();
+    }
+
+    std::optional<DecodedMessage> Decode(std::string_view bytes) {
+        Reader reader{ bytes };
+        auto g = reader.Byte();
+        auto s = reader.Byte();
+        auto version = reader.Byte();
+        auto kind = reader.Byte();
+        auto tick = reader.Varint();
+        if (!g || *g != 'G' || !s || *s != 'S' || !version || *version != FORMAT_VERSION || !kind || !tick) {
+            return std::nullopt;
+        }
+
+        DecodedMessage message{ static_cast<MessageKind>(*kind), *tick, {}, {} };
+        bool ok = false;
+        switch (message.kind) {
+        case MessageKind::State:
+            ok = DecodeDogs(reader, message.dogs) && DecodeLoot(reader, message.loot);
+            break;
+        case MessageKind::Players:
+            ok = DecodePlayers(reader, message.dogs);
+            break;
+        }
+        if (!ok || !reader.AtEnd()) {
+            return std::nullopt;
+        }
+        return message;
+    }
+
+}  // namespace app::binary
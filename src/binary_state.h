@@ -0,0 +1,51 @@
+#pragma once
+#include "game_snapshot.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary encoding of /api/v1/game/state and /api/v1/game/players, served when the
+// request carries "Accept: application/x-game-state". Version 1:
+//
+//   message  := magic:'G' 'S'  version:u8 = 1  kind:u8  tick:varint  body
+//   kind 1 (state):
+//     body   := dog_count:varint dog*  loot_count:varint loot*
+//     dog    := player_id:varint  x:svarint  y:svarint  vx:svarint  vy:svarint
+//               dir:u8  score:varint  bag_count:varint (item_id:varint item_type:varint)*
+//     loot   := id:varint  type:varint  x:svarint  y:svarint
+//   kind 2 (players):
+//     body   := player_count:varint (player_id:varint name_size:varint name:u8[name_size])*
+//
+// varint is unsigned LEB128; svarint is a zigzag-encoded varint. Positions and
+// speeds are fixed-point with POSITION_SCALE units per map unit. dir is 0..3 for
+// U, D, L, R. Players and loot are sorted by id. Decoders must reject a version
+// they do not know; fields are only ever added in a new version.
+namespace app::binary {
+
+    inline constexpr std::string_view MEDIA_TYPE = "application/x-game-state";
+    inline constexpr uint8_t FORMAT_VERSION = 1;
+    inline constexpr double POSITION_SCALE = 1000.0;
+
+    enum class MessageKind : uint8_t {
+        State = 1,
+        Players = 2,
+    };
+
+    std::string EncodeState(const MapSnapshot& snapshot);
+    std::string EncodePlayers(const MapSnapshot& snapshot);
+
+    // Reference decoder. Fields the players message does not carry are left
+    // default-initialized; positions come back rounded to the fixed-point grid.
+    struct DecodedMessage {
+        MessageKind kind;
+        uint64_t tick;
+        std::vector<DogState> dogs;
+        std::vector<LootState> loot;
+    };
+
+    std::optional<DecodedMessage> Decode(std::string_view bytes);
+
+}  // namespace app::binary
@@ -0,0 +1,167 @@
+#include "collision_detector.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace model {
+
+    namespace {
+
+        constexpr double HALF_WIDTH = Map::ROAD_HALF_WIDTH;
+
+        template <typename Lines>
+        std::vector<Coord> SortedKeys(const Lines& lines) {
+            std::vector<Coord> keys;
+            keys.reserve(lines.size());
+            for (const auto& [key, _] : lines) {
+                keys.push_back(key);
+            }
+            std::sort(keys.begin(), keys.end());
+            return keys;
+        }
+
+        template <typename Fn>
+        void ForEachKeyIn(const std::vector<Coord>& keys, Coord from, Coord to, Fn&& fn) {
+            if (from > to) {
+                std::swap(from, to);
+            }
+            for (auto it = std::lower_bound(keys.begin(), keys.end(), from); it != keys.end() && *it <= to; ++it) {
+                fn(*it);
+            }
+        }
+
+    }  // namespace
+
+    CollisionDetector::CollisionDetector(const Map& map) {
+        // A zero-length road is both horizontal and vertical, so it lands on both lines.
+        for (const auto& road : map.GetRoads()) {
+            const auto start = road.GetStart();
+            const auto end = road.GetEnd();
+            if (road.IsHorizontal()) {
+                const auto [lo, hi] = std::minmax(start.x, end.x);
+                rows_[start.y].push_back({ lo - HALF_WIDTH, hi + HALF_WIDTH });
+            }
+            if (road.IsVertical()) {
+                const auto [lo, hi] = std::minmax(start.y, end.y);
+                columns_[start.x].push_back({ lo - HALF_WIDTH, hi + HALF_WIDTH });
+            }
+        }
+
+        const auto row_keys = SortedKeys(rows_);
+        const auto column_keys = SortedKeys(columns_);
+
+        // Roads and coordinates are integral, so a perpendicular road crosses line k
+        // exactly when k lies between its ends; it then adds its own corridor there.
+        for (const auto& road : map.GetRoads()) {
+            const auto start = road.GetStart();
+            const auto end = road.GetEnd();
+            if (road.IsVertical()) {
+                ForEachKeyIn(row_keys, start.y, end.y, [&](Coord y) {
+                    rows_[y].push_back({ start.x - HALF_WIDTH, start.x + HALF_WIDTH });
+                });
+            }
+            if (road.IsHorizontal()) {
+                ForEachKeyIn(column_keys, start.x, end.x, [&](Coord x) {
+                    columns_[x].push_back({ start.y - HALF_WIDTH, start.y + HALF_WIDTH });
+                });
+            }
+        }
+
+        for (auto& [_, intervals] : rows_) {
+            Merge(intervals);
+        }
+        for (auto& [_, intervals] : columns_) {
+            Merge(intervals);
+        }
+    }
+
+    MovementResult CollisionDetector::CalculateMovement(Position pos, Velocity vel, double dt) const {
+        if (vel.vx == 0.0 && vel.vy == 0.0) {
+            return { pos, false };
+        }
+
+        const bool along_x = vel.vx != 0.0;
+        auto free = FreeInterval(pos, along_x);
+        if (!free) {
+            return { pos, true };
+        }
+
+        double& coord = along_x ? pos.x : pos.y;
+        const double target = coord + (along_x ? vel.vx : vel.vy) * dt;
+        coord = std::clamp(target, free->lo, free->hi);
+        return { pos, coord != target };
+    }
+
+    MotionBounds CollisionDetector::GetMotionBounds(Position pos, Velocity vel) const {
+        MotionBounds bounds{ pos.x, pos.x, pos.y, pos.y };
+        if (vel.vx == 0.0 && vel.vy == 0.0) {
+            return bounds;
+        }
+
+        const bool along_x = vel.vx != 0.0;
+        if (auto free = FreeInterval(pos, along_x)) {
+            (along_x ? bounds.min_x : bounds.min_y) = free->lo;
+            (along_x ? bounds.max_x : bounds.max_y) = free->hi;
+        }
+        return bounds;
+    }
+
+    void CollisionDetector::Merge(Intervals& intervals) {
+        std::sort(intervals.begin(), intervals.end(), [](const Interval& lhs, const Interval& rhs) {
+            return lhs.lo < rhs.lo;
+        });
+
+        size_t merged = 0;
+        for (size_t i = 1; i < intervals.size(); ++i) {
+            if (intervals[i].lo <= intervals[merged].hi) {
+                intervals[merged].hi = std::max(intervals[merged].hi, intervals[i].hi);
+            }
+            else {
+                intervals[++merged] = intervals[i];
+            }
+        }
+        intervals.resize(std::min(intervals.size(), merged + 1));
+    }
+
+    std::optional<CollisionDetector::Interval> CollisionDetector::FindInterval(const Lines& lines,
+        double across, double along) {
+        const double key = std::round(across);
+        if (std::abs(across - key) > HALF_WIDTH) {
+            return std::nullopt;
+        }
+
+        auto line = lines.find(static_cast<Coord>(key));
+        if (line == lines.end()) {
+            return std::nullopt;
+        }
+
+        const auto& intervals = line->second;
+        auto it = std::upper_bound(intervals.begin(), intervals.end(), along, [](double value, const Interval& interval) {
+            return value < interval.lo;
+        });
+        if (it == intervals.begin() || along > std::prev(it)->hi) {
+            return std::nullopt;
+        }
+        return *std::prev(it);
+    }
+
+    std::optional<CollisionDetector::Interval> CollisionDetector::FreeInterval(Position pos, bool along_x) const {
+        const Lines& lines = along_x ? rows_ : columns_;
+        const Lines& crossing = along_x ? columns_ : rows_;
+        const double across = along_x ? pos.y : pos.x;
+        const double along = along_x ? pos.x : pos.y;
+
+        if (auto interval = FindInterval(lines, across, along)) {
+            return interval;
+        }
+
+        // Off every road line in this direction, the dog can only be inside a single
+        // perpendicular corridor: those are one unit apart and never touch.
+        if (FindInterval(crossing, along, across)) {
+            const double center = std::round(along);
+            return Interval{ center - HALF_WIDTH, center + HALF_WIDTH };
+        }
+        return std::nullopt;
+    }
+
+}  // namespace model
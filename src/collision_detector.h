@@ -0,0 +1,51 @@
+#pragma once
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "model.h"
+
+namespace model {
+
+    struct MovementResult {
+        Position new_position;
+        bool collision_occurred;
+    };
+
+    // Road graph of one map, built once at load time. For every line that carries a
+    // road, the corridors crossing it (the road itself widened by ROAD_HALF_WIDTH and
+    // every perpendicular road over it) are merged into sorted disjoint intervals, so
+    // a straight move looks up one line and binary-searches it instead of testing
+    // every road on the map.
+    class CollisionDetector {
+    public:
+        explicit CollisionDetector(const Map& map);
+
+        // Moves pos along vel for dt, stopping at the edge of the road corridors.
+        // Only axis-aligned velocities are supported, as dogs never move diagonally.
+        MovementResult CalculateMovement(Position pos, Velocity vel, double dt) const;
+
+        // Box a dog at pos can travel along vel before it reaches the corridor edge.
+        MotionBounds GetMotionBounds(Position pos, Velocity vel) const;
+
+    private:
+        struct Interval {
+            double lo, hi;
+        };
+
+        using Intervals = std::vector<Interval>;
+        using Lines = std::unordered_map<Coord, Intervals>;
+
+        static void Merge(Intervals& intervals);
+        static std::optional<Interval> FindInterval(const Lines& lines, double across, double along);
+
+        // Free interval along the direction of motion that contains pos.
+        std::optional<Interval> FreeInterval(Position pos, bool along_x) const;
+
+        // Horizontal lines y = key with their free x intervals, and vertical lines
+        // x = key with their free y intervals.
+        Lines rows_;
+        Lines columns_;
+    };
+
+}  // namespace model
@@ -0,0 +1,194 @@
+#include "connection_pool.h"
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+namespace app::db {
+
+    ConnectionPool::ConnectionPool(size_t capacity, ConnectionFactory connection_factory, Settings settings,
+        size_t threads, metrics::Registry* metrics)
+        : connection_factory_(std::move(connection_factory))
+        , settings_(settings)
+        , metrics_(metrics)
+        , workers_(std::max<size_t>(1, threads ? threads : capacity))
+        , health_timer_(workers_.get_executor()) {
+        for (size_t i = 0; i < capacity; ++i) {
+            idle_.push_back(Connect());
+        }
+        std::lock_guard lock{mutex_};
+        ScheduleHealthCheck();
+    }
+
+    ConnectionPool::~ConnectionPool() {
+        Stop();
+    }
+
+    void ConnectionPool::SetConnectionSetup(ConnectionSetup setup) {
+        std::deque<ConnectionPtr> idle;
+        {
+            std::lock_guard lock{mutex_};
+            setup_ = setup;
+            idle.swap(idle_);
+        }
+        for (auto& conn : idle) {
+            setup(*conn);
+            std::lock_guard lock{mutex_};
+            HandOver(std::move(conn));
+        }
+    }
+
+    ConnectionPool::ConnectionWrapper ConnectionPool::GetConnection() {
+        return AsyncGetConnection(net::use_future).get();
+    }
+
+    void ConnectionPool::Stop() {
+        {
+            std::lock_guard lock{mutex_};
+            if (stopped_) {
+                return;
+            }
+            stopped_ = true;
+            health_timer_.cancel();
+            for (auto& waiter : waiters_) {
+                waiter->timer.cancel();
+            }
+            waiters_.clear();
+        }
+        workers_.join();
+    }
+
+    void ConnectionPool::Enqueue(const std::shared_ptr<Waiter>& waiter) {
+        if (!stopped_ && !idle_.empty()) {
+            waiter->conn = std::move(idle_.back());
+            idle_.pop_back();
+            waiter->timer.expires_after(Clock::duration::zero());
+        } else if (stopped_) {
+            waiter->timer.expires_after(Clock::duration::zero());
+        } else {
+            waiter->timer.expires_after(settings_.wait_timeout);
+            waiters_.push_back(waiter);
+        }
+    }
+
+    void ConnectionPool::HandOver(ConnectionPtr&& conn) {
+        // Waiters that already timed out are skipped; they are only removed here.
+        while (!waiters_.empty()) {
+            auto waiter = std::move(waiters_.front());
+            waiters_.pop_front();
+            if (!waiter->done) {
+                waiter->conn = std::move(conn);
+                waiter->timer.cancel();
+                return;
+            }
+        }
+        idle_.push_back(std::move(conn));
+    }
+
+    ConnectionPool::ConnectionPtr ConnectionPool::Finish(Waiter& waiter, boost::system::error_code& ec) {
+        std::lock_guard lock{mutex_};
+        waiter.done = true;
+        if (!waiter.conn) {
+            ec = stopped_ ? net::error::operation_aborted : net::error::timed_out;
+        }
+        if (metrics_) {
+            metrics_->RecordDbPoolWait(Clock::now() - waiter.enqueued_at, !waiter.conn);
+        }
+        return std::move(waiter.conn);
+    }
+
+    void ConnectionPool::ReturnConnection(ConnectionPtr&& conn) {
+        std::lock_guard lock{mutex_};
+        if (!conn->is_open()) {
+            conn.reset();
+            ++broken_;
+            return;
+        }
+        HandOver(std::move(conn));
+    }
+
+    ConnectionPool::ConnectionPtr ConnectionPool::Connect() {
+        auto conn = connection_factory_();
+        ConnectionSetup setup;
+        {
+            std::lock_guard lock{mutex_};
+            setup = setup_;
+        }
+        if (setup) {
+            setup(*conn);
+        }
+        return conn;
+    }
+
+    void ConnectionPool::ScheduleHealthCheck() {
+        if (stopped_) {
+            return;
+        }
+        health_timer_.expires_after(settings_.health_check_period);
+        health_timer_.async_wait([this](boost::system::error_code ec) {
+            if (!ec) {
+                CheckHealth();
+            }
+        });
+    }
+
+    void ConnectionPool::CheckHealth() {
+        // Idle connections are checked one at a time, so a waiter is never starved
+        // for longer than a single ping.
+        size_t to_check;
+        {
+            std::lock_guard lock{mutex_};
+            to_check = idle_.size();
+        }
+        for (; to_check > 0; --to_check) {
+            ConnectionPtr conn;
+            {
+                std::lock_guard lock{mutex_};
+                if (stopped_ || idle_.empty()) {
+                    break;
+                }
+                conn = std::move(idle_.front());
+                idle_.pop_front();
+            }
+            try {
+                pqxx::nontransaction tx{*conn};
+                tx.exec("SELECT 1");
+            } catch (const std::exception& e) {
+                std::cerr << "Database connection failed a health check: " << e.what() << std::endl;
+                conn.reset();
+            }
+            std::lock_guard lock{mutex_};
+            if (conn) {
+                HandOver(std::move(conn));
+            } else {
+                ++broken_;
+            }
+        }
+
+        while (true) {
+            {
+                std::lock_guard lock{mutex_};
+                if (stopped_ || broken_ == 0) {
+                    break;
+                }
+            }
+            ConnectionPtr conn;
+            try {
+                conn = Connect();
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to reopen a database connection: " << e.what() << std::endl;
+                break;
+            }
+            std::lock_guard lock{mutex_};
+            --broken_;
+            HandOver(std::move(conn));
+        }
+
+        std::lock_guard lock{mutex_};
+        ScheduleHealthCheck();
+    }
+
+}  // namespace app::db
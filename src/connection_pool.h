@@ -0,0 +1,183 @@
+#pragma once
+#include "metrics.h"
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <pqxx/pqxx>
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace app::db {
+
+    namespace net = boost::asio;
+
+    struct ConnectionPoolSettings {
+        std::chrono::milliseconds wait_timeout{ 2000 };
+        std::chrono::milliseconds health_check_period{ 10000 };
+    };
+
+    // Database connections shared by the HTTP handlers and the background writers.
+    // Acquisition never blocks an io_context worker: AsyncGetConnection takes an asio
+    // completion token and fails with net::error::timed_out once wait_timeout passes
+    // without a free connection. The pool runs its own threads, which own the wait
+    // timers and the periodic liveness checks and are where DB work is meant to run.
+    //
+    // A connection that comes back closed is dropped and reopened by the next health
+    // check, as is an idle one that fails a "SELECT 1"; every new connection runs the
+    // setup hook, so prepared statements survive reconnects.
+    class ConnectionPool {
+    public:
+        using ConnectionPtr = std::shared_ptr<pqxx::connection>;
+        using ConnectionFactory = std::function<ConnectionPtr()>;
+        using ConnectionSetup = std::function<void(pqxx::connection&)>;
+        using Executor = net::thread_pool::executor_type;
+
+        using Settings = ConnectionPoolSettings;
+
+        class ConnectionWrapper {
+        public:
+            ConnectionWrapper() noexcept = default;
+
+            ConnectionWrapper(ConnectionPtr&& conn, ConnectionPool& pool) noexcept
+                : conn_{std::move(conn)}
+                , pool_{&pool} {
+            }
+
+            ConnectionWrapper(const ConnectionWrapper&) = delete;
+            ConnectionWrapper& operator=(const ConnectionWrapper&) = delete;
+            ConnectionWrapper(ConnectionWrapper&&) noexcept = default;
+
+            ConnectionWrapper& operator=(ConnectionWrapper&& other) noexcept {
+                if (this != &other) {
+                    Release();
+                    conn_ = std::move(other.conn_);
+                    pool_ = other.pool_;
+                }
+                return *this;
+            }
+
+            explicit operator bool() const noexcept {
+                return conn_ != nullptr;
+            }
+
+            pqxx::connection& operator*() const& noexcept {
+                return *conn_;
+            }
+
+            pqxx::connection& operator*() const&& = delete;
+
+            pqxx::connection* operator->() const& noexcept {
+                return conn_.get();
+            }
+
+            // Hands the connection back before the wrapper goes out of scope.
+            void Release() noexcept {
+                if (conn_) {
+                    pool_->ReturnConnection(std::move(conn_));
+                }
+            }
+
+            ~ConnectionWrapper() {
+                Release();
+            }
+
+        private:
+            ConnectionPtr conn_;
+            ConnectionPool* pool_ = nullptr;
+        };
+
+        // Opens capacity connections up front and runs threads pool threads.
+        ConnectionPool(size_t capacity, ConnectionFactory connection_factory, Settings settings = {},
+            size_t threads = 0, metrics::Registry* metrics = nullptr);
+        ~ConnectionPool();
+
+        ConnectionPool(const ConnectionPool&) = delete;
+        ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+        // Runs setup on every connection now and on each one opened later. Call it
+        // before the pool is in use: connections already handed out are not set up.
+        void SetConnectionSetup(ConnectionSetup setup);
+
+        Executor GetExecutor() noexcept {
+            return workers_.get_executor();
+        }
+
+        // Completes with (error_code, ConnectionWrapper) on the token's associated
+        // executor, or on the pool's threads when it has none.
+        template <typename CompletionToken>
+        auto AsyncGetConnection(CompletionToken&& token) {
+            return net::async_initiate<CompletionToken, void(boost::system::error_code, ConnectionWrapper)>(
+                [this](auto handler) {
+                    auto waiter = std::make_shared<Waiter>(workers_.get_executor());
+                    auto executor = net::get_associated_executor(handler, workers_.get_executor());
+
+                    std::lock_guard lock{mutex_};
+                    Enqueue(waiter);
+                    waiter->timer.async_wait(net::bind_executor(executor,
+                        [this, waiter, handler = std::move(handler)](boost::system::error_code) mutable {
+                            boost::system::error_code ec;
+                            auto conn = Finish(*waiter, ec);
+                            std::move(handler)(ec, conn ? ConnectionWrapper{std::move(conn), *this} : ConnectionWrapper{});
+                        }));
+                },
+                token);
+        }
+
+        // Blocks the calling thread, so it is only for startup and background threads;
+        // throws boost::system::system_error on timeout.
+        ConnectionWrapper GetConnection();
+
+        // Fails pending waits with operation_aborted and joins the pool's threads
+        // once the work already running on them is done.
+        void Stop();
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Waiter {
+            explicit Waiter(Executor executor)
+                : timer(executor) {
+            }
+
+            net::steady_timer timer;
+            Clock::time_point enqueued_at = Clock::now();
+            ConnectionPtr conn;
+            bool done = false;
+        };
+
+        // Both expect mutex_ to be held.
+        void Enqueue(const std::shared_ptr<Waiter>& waiter);
+        void HandOver(ConnectionPtr&& conn);
+
+        ConnectionPtr Finish(Waiter& waiter, boost::system::error_code& ec);
+        void ReturnConnection(ConnectionPtr&& conn);
+        ConnectionPtr Connect();
+        void ScheduleHealthCheck();
+        void CheckHealth();
+
+        ConnectionFactory connection_factory_;
+        Settings settings_;
+        metrics::Registry* metrics_;
+        net::thread_pool workers_;
+        net::steady_timer health_timer_;
+
+        std::mutex mutex_;
+        ConnectionSetup setup_;
+        std::deque<ConnectionPtr> idle_;
+        std::deque<std::shared_ptr<Waiter>> waiters_;
+        // Slots whose connection was dropped and is waiting to be reopened.
+        size_t broken_ = 0;
+        bool stopped_ = false;
+    };
+
+}  // namespace app::db
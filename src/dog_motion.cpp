@@ -0,0 +1,74 @@
+#include "dog_motion.h"
+
+namespace model {
+
+    size_t DogMotion::Add(double pos_x, double pos_y, uint16_t map) {
+        const size_t slot = x.size();
+        x.push_back(pos_x);
+        y.push_back(pos_y);
+        vx.push_back(0.0);
+        vy.push_back(0.0);
+        min_x.push_back(pos_x);
+        max_x.push_back(pos_x);
+        min_y.push_back(pos_y);
+        max_y.push_back(pos_y);
+        map_index.push_back(map);
+        return slot;
+    }
+
+    void DogMotion::Reserve(size_t capacity) {
+        for (auto* column : { &x, &y, &vx, &vy, &min_x, &max_x, &min_y, &max_y }) {
+            column->reserve(capacity);
+        }
+        map_index.reserve(capacity);
+    }
+
+    void DogMotion::SwapRemove(size_t slot) {
+        const size_t last = x.size() - 1;
+        if (slot != last) {
+            x[slot] = x[last];
+            y[slot] = y[last];
+            vx[slot] = vx[last];
+            vy[slot] = vy[last];
+            min_x[slot] = min_x[last];
+            max_x[slot] = max_x[last];
+            min_y[slot] = min_y[last];
+            max_y[slot] = max_y[last];
+            map_index[slot] = map_index[last];
+        }
+        x.pop_back();
+        y.pop_back();
+        vx.pop_back();
+        vy.pop_back();
+        min_x.pop_back();
+        max_x.pop_back();
+        min_y.pop_back();
+        max_y.pop_back();
+        map_index.pop_back();
+    }
+
+    void DogMotion::Advance(double dt, std::span<uint8_t> needs_scalar) noexcept {
+        const size_t n = x.size();
+
+        double* __restrict px = x.data();
+        double* __restrict py = y.data();
+        const double* __restrict pvx = vx.data();
+        const double* __restrict pvy = vy.data();
+        const double* __restrict lo_x = min_x.data();
+        const double* __restrict hi_x = max_x.data();
+        const double* __restrict lo_y = min_y.data();
+        const double* __restrict hi_y = max_y.data();
+        uint8_t* __restrict flags = needs_scalar.data();
+
+        // Branch-free so the compiler can vectorize it for the target ISA.
+        for (size_t i = 0; i < n; ++i) {
+            const double nx = px[i] + pvx[i] * dt;
+            const double ny = py[i] + pvy[i] * dt;
+            const bool inside = (nx >= lo_x[i]) & (nx <= hi_x[i]) & (ny >= lo_y[i]) & (ny <= hi_y[i]);
+            px[i] = inside ? nx : px[i];
+            py[i] = inside ? ny : py[i];
+            flags[i] = !inside;
+        }
+    }
+
+}  // namespace model
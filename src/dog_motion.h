@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace model {
+
+    struct MotionBounds {
+        double min_x, max_x;
+        double min_y, max_y;
+    };
+
+    // Hot per-dog kinematic state stored as parallel arrays. Slot i of every array
+    // belongs to the same dog; Game keeps the slots dense and in step with its Dog list.
+    class DogMotion {
+    public:
+        size_t Size() const noexcept {
+            return x.size();
+        }
+
+        size_t Add(double pos_x, double pos_y, uint16_t map);
+        void Reserve(size_t capacity);
+        void SwapRemove(size_t slot);
+
+        void SetPosition(size_t slot, double pos_x, double pos_y) noexcept {
+            x[slot] = pos_x;
+            y[slot] = pos_y;
+            ResetBounds(slot);
+        }
+
+        void SetVelocity(size_t slot, double vel_x, double vel_y) noexcept {
+            vx[slot] = vel_x;
+            vy[slot] = vel_y;
+            ResetBounds(slot);
+        }
+
+        void SetBounds(size_t slot, const MotionBounds& bounds) noexcept {
+            min_x[slot] = bounds.min_x;
+            max_x[slot] = bounds.max_x;
+            min_y[slot] = bounds.min_y;
+            max_y[slot] = bounds.max_y;
+        }
+
+        // Advances every dog by v * dt in one pass. A dog whose new position would
+        // leave its cached straight-line bounds is left where it was and flagged in
+        // needs_scalar, so the caller can resolve it with the collision detector.
+        // needs_scalar must hold Size() flags.
+        void Advance(double dt, std::span<uint8_t> needs_scalar) noexcept;
+
+        std::vector<double> x, y;
+        std::vector<double> vx, vy;
+        std::vector<double> min_x, max_x, min_y, max_y;
+        // model::MapIndex of the dog's map.
+        std::vector<uint16_t> map_index;
+
+    private:
+        // Collapses the bounds to the current point: a moving dog then takes the
+        // scalar path on its next step, which recomputes the bounds.
+        void ResetBounds(size_t slot) noexcept {
+            SetBounds(slot, { x[slot], x[slot], y[slot], y[slot] });
+        }
+    };
+
+}  // namespace model
@@ -0,0 +1,176 @@
+#include "game_snapshot.h"
+#include "binary_state.h"
+
+#include <algorithm>
+#include <boost/json.hpp>
+
+namespace app {
+
+    namespace json = boost::json;
+
+    namespace {
+
+        std::string_view DirectionToString(model::Direction direction) {
+            switch (direction) {
+            case model::Direction::North:
+                return "U";
+            case model::Direction::South:
+                return "D";
+            case model::Direction::West:
+                return "L";
+            case model::Direction::East:
+                return "R";
+            }
+            return "U";
+        }
+
+        bool SameState(const DogState& lhs, const DogState& rhs) {
+            auto same_item = [](const model::BagItem& a, const model::BagItem& b) {
+                return a.id == b.id && a.type == b.type;
+            };
+            return lhs.position.x == rhs.position.x && lhs.position.y == rhs.position.y
+                && lhs.speed.vx == rhs.speed.vx && lhs.speed.vy == rhs.speed.vy
+                && lhs.direction == rhs.direction && lhs.score == rhs.score
+                && std::equal(lhs.bag.begin(), lhs.bag.end(), rhs.bag.begin(), rhs.bag.end(), same_item);
+        }
+
+        json::object SerializeDog(const DogState& dog, json::storage_ptr sp) {
+            json::array bag(sp);
+            bag.reserve(dog.bag.size());
+            for (const auto& item : dog.bag) {
+                bag.emplace_back(json::object({ { "id", item.id }, { "type", item.type } }, sp));
+            }
+
+            json::object result(sp);
+            result["pos"] = { dog.position.x, dog.position.y };
+            result["speed"] = { dog.speed.vx, dog.speed.vy };
+            result["dir"] = DirectionToString(dog.direction);
+            result["bag"] = std::move(bag);
+            result["score"] = dog.score;
+            return result;
+        }
+
+        json::object SerializeLoot(const LootState& loot, json::storage_ptr sp) {
+            return json::object({
+                { "type", loot.type },
+                { "pos", { loot.position.x, loot.position.y } },
+            }, sp);
+        }
+
+    }  // namespace
+
+    MapSnapshot BuildMapSnapshot(const model::Game& game, size_t map_index,
+        const std::vector<const model::Player*>& players, uint64_t tick) {
+        const auto& map = game.GetMaps()[map_index];
+
+        MapSnapshot snapshot;
+        snapshot.tick = tick;
+
+        json::monotonic_resource arena;
+        json::object players_names(&arena);
+
+        snapshot.dogs.reserve(players.size());
+        for (const auto* player : players) {
+            const auto* dog = game.FindDog(player->GetDogId());
+            if (!dog) {
+                continue;
+            }
+            snapshot.dogs.push_back({ player->GetId(), player->GetName(), dog->GetPosition(), dog->GetVelocity(),
+                dog->GetDirection(), dog->GetBag(), dog->GetScore() });
+            players_names[std::to_string(*player->GetId())] = { { "name", player->GetName() } };
+        }
+        std::sort(snapshot.dogs.begin(), snapshot.dogs.end(), [](const DogState& lhs, const DogState& rhs) {
+            return lhs.player_id < rhs.player_id;
+        });
+
+        snapshot.loot.reserve(map.GetLootItems().size());
+        for (const auto& loot : map.GetLootItems()) {
+            snapshot.loot.push_back({ loot.GetId(), loot.GetType(), loot.GetPosition() });
+        }
+        std::sort(snapshot.loot.begin(), snapshot.loot.end(), [](const LootState& lhs, const LootState& rhs) {
+            return lhs.id < rhs.id;
+        });
+
+        json::object players_state(&arena);
+        for (const auto& dog : snapshot.dogs) {
+            players_state[std::to_string(*dog.player_id)] = SerializeDog(dog, &arena);
+        }
+
+        json::object lost_objects(&arena);
+        for (const auto& loot : snapshot.loot) {
+            lost_objects[std::to_string(*loot.id)] = SerializeLoot(loot, &arena);
+        }
+
+        json::object state(&arena);
+        state["players"] = std::move(players_state);
+        state["lostObjects"] = std::move(lost_objects);
+
+        snapshot.state = json::serialize(state);
+        snapshot.players = json::serialize(players_names);
+        snapshot.binary_state = binary::EncodeState(snapshot);
+        snapshot.binary_players = binary::EncodePlayers(snapshot);
+        return snapshot;
+    }
+
+    std::string BuildKeyframeMessage(const MapSnapshot& snapshot) {
+        // The state body is already JSON, so it is spliced in rather than re-serialized.
+        std::string message = "{\"type\":\"keyframe\",\"tick\":" + std::to_string(snapshot.tick) + ",\"state\":";
+        message.reserve(message.size() + snapshot.state.size() + 1);
+        message += snapshot.state;
+        message += '}';
+        return message;
+    }
+
+    std::string BuildDeltaMessage(const MapSnapshot& base, const MapSnapshot& current) {
+        json::monotonic_resource arena;
+        json::object players(&arena);
+        json::array removed_players(&arena);
+        json::object lost_objects(&arena);
+        json::array removed_lost_objects(&arena);
+
+        // Both sides are sorted by id, so one merge pass finds every difference.
+        auto base_dog = base.dogs.begin();
+        for (const auto& dog : current.dogs) {
+            for (; base_dog != base.dogs.end() && base_dog->player_id < dog.player_id; ++base_dog) {
+                removed_players.emplace_back(*base_dog->player_id);
+            }
+            if (base_dog != base.dogs.end() && base_dog->player_id == dog.player_id) {
+                const bool changed = !SameState(*base_dog, dog);
+                ++base_dog;
+                if (!changed) {
+                    continue;
+                }
+            }
+            players[std::to_string(*dog.player_id)] = SerializeDog(dog, &arena);
+        }
+        for (; base_dog != base.dogs.end(); ++base_dog) {
+            removed_players.emplace_back(*base_dog->player_id);
+        }
+
+        auto base_loot = base.loot.begin();
+        for (const auto& loot : current.loot) {
+            for (; base_loot != base.loot.end() && base_loot->id < loot.id; ++base_loot) {
+                removed_lost_objects.emplace_back(*base_loot->id);
+            }
+            if (base_loot != base.loot.end() && base_loot->id == loot.id) {
+                ++base_loot;
+                continue;
+            }
+            lost_objects[std::to_string(*loot.id)] = SerializeLoot(loot, &arena);
+        }
+        for (; base_loot != base.loot.end(); ++base_loot) {
+            removed_lost_objects.emplace_back(*base_loot->id);
+        }
+
+        json::object message(&arena);
+        message["type"] = "delta";
+        message["tick"] = current.tick;
+        message["base"] = base.tick;
+        message["players"] = std::move(players);
+        message["removedPlayers"] = std::move(removed_players);
+        message["lostObjects"] = std::move(lost_objects);
+        message["removedLostObjects"] = std::move(removed_lost_objects);
+        return json::serialize(message);
+    }
+
+}  // namespace app
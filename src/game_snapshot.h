@@ -0,0 +1,46 @@
+#pragma once
+#include "model.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace app {
+
+    struct DogState {
+        model::Player::Id player_id;
+        std::string name;
+        model::Position position;
+        model::Velocity speed;
+        model::Direction direction;
+        std::vector<model::BagItem> bag;
+        int score;
+    };
+
+    struct LootState {
+        model::LootItem::Id id;
+        int type;
+        model::Position position;
+    };
+
+    // Immutable view of one map, serialized once and shared by every reader until
+    // the next tick (or the next join or action on that map) replaces it.
+    struct MapSnapshot {
+        uint64_t tick = 0;
+        std::vector<DogState> dogs;   // sorted by player_id
+        std::vector<LootState> loot;  // sorted by id
+        std::string state;    // body of /api/v1/game/state
+        std::string players;  // body of /api/v1/game/players
+        std::string binary_state;    // the same, in the binary_state.h encoding
+        std::string binary_players;
+    };
+
+    MapSnapshot BuildMapSnapshot(const model::Game& game, size_t map_index,
+        const std::vector<const model::Player*>& players, uint64_t tick);
+
+    // Push messages for subscribers. A keyframe carries the whole state; a delta
+    // carries the dogs and loot that differ from base, plus the ids that are gone.
+    std::string BuildKeyframeMessage(const MapSnapshot& snapshot);
+    std::string BuildDeltaMessage(const MapSnapshot& base, const MapSnapshot& current);
+
+}  // namespace app
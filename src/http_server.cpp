@@ -1,12 +1,21 @@
 
 #include "http_server.h"
+#include <algorithm>
 #include <iostream>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <sys/sendfile.h>
+#endif
 
 namespace http_server {
 
-Session::Session(tcp::socket&& socket, RequestHandler&& handler)
+Session::Session(tcp::socket&& socket, RequestHandler&& handler, UpgradeHandler&& upgrade_handler)
     : stream_(std::move(socket))
-    , handler_(std::move(handler)) {
+    , handler_(std::move(handler))
+    , upgrade_handler_(std::move(upgrade_handler))
+    , file_deadline_(stream_.get_executor()) {
 }
 
 void Session::Run() {
@@ -16,48 +25,350 @@ void Session::Run() {
 }
 
 void Session::Read() {
-    req_ = {};
+    if (reading_ || read_done_ || in_flight_.size() >= MAX_IN_FLIGHT) {
+        return;
+    }
+    reading_ = true;
+    parser_.emplace();
     stream_.expires_after(std::chrono::seconds(30));
     
-    http::async_read(stream_, buffer_, req_,
+    http::async_read(stream_, buffer_, *parser_,
         beast::bind_front_handler(&Session::OnRead, shared_from_this()));
 }
 
 void Session::OnRead(beast::error_code ec, std::size_t bytes_transferred) {
+    reading_ = false;
     if (ec == http::error::end_of_stream) {
-        return stream_.socket().close();
+        read_done_ = true;
+        if (in_flight_.empty() && !writing_) {
+            stream_.socket().close();
+        }
+        return;
     }
     
     if (ec) {
-        std::cerr << "Read error: " << ec.message() << std::endl;
+        // A close after the last response cancels the read that was waiting for more.
+        if (ec != net::error::operation_aborted) {
+            std::cerr << "Read error: " << ec.message() << std::endl;
+        }
+        read_done_ = true;
         return;
     }
     
-    handler_(std::move(req_), [self = shared_from_this()](auto&& response) {
-        auto sp = std::make_shared<http::response<http::string_body>>(std::move(response));
-        
-        http::async_write(self->stream_, *sp,
-            beast::bind_front_handler(&Session::OnWrite, self, sp->need_eof()));
-    });
+    if (upgrade_handler_ && websocket::is_upgrade(parser_->get())) {
+        // The stream changes hands, so earlier requests are answered first.
+        read_done_ = true;
+        pending_upgrade_.emplace(parser_->release());
+        if (in_flight_.empty() && !writing_) {
+            Upgrade();
+        }
+        return;
+    }
+    
+    if (!parser_->get().keep_alive()) {
+        read_done_ = true;
+    }
+    const std::uint64_t sequence = front_sequence_ + in_flight_.size();
+    in_flight_.emplace_back();
+    handler_(parser_->release(), ResponseSender{shared_from_this(), sequence});
+    Read();
+}
+
+void Session::Upgrade() {
+    stream_.expires_never();
+    auto ws = std::make_shared<WebSocketSession>(std::move(stream_));
+    auto req = std::move(*pending_upgrade_);
+    pending_upgrade_.reset();
+    upgrade_handler_(std::move(req), std::move(ws));
+}
+
+void Session::Complete(std::uint64_t sequence, Response&& response) {
+    net::dispatch(stream_.get_executor(),
+        [self = shared_from_this(), sequence, response = std::move(response)]() mutable {
+            // A connection that failed has dropped its unanswered requests.
+            if (sequence < self->front_sequence_ || sequence - self->front_sequence_ >= self->in_flight_.size()) {
+                return;
+            }
+            self->in_flight_[sequence - self->front_sequence_].emplace(std::move(response));
+            self->WriteNext();
+        });
+}
+
+void Session::WriteNext() {
+    if (writing_ || in_flight_.empty() || !in_flight_.front()) {
+        return;
+    }
+    writing_ = true;
+    Response response = std::move(*in_flight_.front());
+    in_flight_.pop_front();
+    ++front_sequence_;
+    
+    if (auto* string_response = std::get_if<http::response<http::string_body>>(&response)) {
+        Write(std::move(*string_response));
+    } else if (auto* shared_response = std::get_if<SharedResponse>(&response)) {
+        WriteShared(std::move(*shared_response));
+    } else {
+        WriteFile(std::move(std::get<FileResponse>(response)));
+    }
+}
+
+void Session::Write(http::response<http::string_body>&& response) {
+    res_.emplace(std::move(response));
+    serializer_.emplace(*res_);
+    
+    http::async_write(stream_, *serializer_,
+        beast::bind_front_handler(&Session::OnWrite, shared_from_this(), res_->need_eof()));
+}
+
+void Session::WriteShared(SharedResponse&& response) {
+    shared_res_.emplace(std::move(response));
+    shared_serializer_.emplace(shared_res_->response);
+    
+    http::async_write(stream_, *shared_serializer_,
+        beast::bind_front_handler(&Session::OnWrite, shared_from_this(), shared_res_->response.need_eof()));
+}
+
+void Session::WriteFile(FileResponse&& response) {
+    file_res_.emplace(std::move(response));
+    file_serializer_.emplace(file_res_->header);
+    const bool close = file_res_->header.need_eof();
+    
+    http::async_write(stream_, *file_serializer_,
+        [self = shared_from_this(), close](beast::error_code ec, std::size_t bytes_transferred) {
+            self->file_serializer_.reset();
+            if (ec) {
+                self->file_res_.reset();
+                return self->OnWrite(close, ec, bytes_transferred);
+            }
+            self->WriteFileBody(close);
+        });
+}
+
+void ResponseSender::operator()(http::response<http::string_body>&& response) const {
+    session_->Complete(sequence_, Session::Response{std::in_place_index<0>, std::move(response)});
+}
+
+void ResponseSender::operator()(FileResponse&& response) const {
+    session_->Complete(sequence_, Session::Response{std::in_place_index<1>, std::move(response)});
+}
+
+void ResponseSender::operator()(SharedResponse&& response) const {
+    session_->Complete(sequence_, Session::Response{std::in_place_index<2>, std::move(response)});
+}
+
+void Session::WriteFileBody(bool close) {
+    auto& res = *file_res_;
+    auto& socket = stream_.socket();
+    constexpr std::uint64_t max_chunk = 1 << 20;
+
+#if defined(__linux__)
+    beast::error_code ec;
+    socket.native_non_blocking(true, ec);
+    while (!ec && res.length > 0) {
+        off_t offset = static_cast<off_t>(res.offset);
+        const ssize_t sent = ::sendfile(socket.native_handle(), res.file.native_handle(), &offset,
+            static_cast<size_t>(std::min(res.length, max_chunk)));
+        if (sent > 0) {
+            res.offset += static_cast<std::uint64_t>(sent);
+            res.length -= static_cast<std::uint64_t>(sent);
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // A peer that stops reading is dropped after as long as a stalled read.
+            file_deadline_.expires_after(std::chrono::seconds(30));
+            file_deadline_.async_wait([self = shared_from_this()](beast::error_code ec) {
+                if (!ec && self->file_deadline_.expiry() <= net::steady_timer::clock_type::now()) {
+                    beast::error_code ignored;
+                    self->stream_.socket().cancel(ignored);
+                }
+            });
+            socket.async_wait(tcp::socket::wait_write, [self = shared_from_this(), close](beast::error_code ec) {
+                self->file_deadline_.cancel();
+                if (ec) {
+                    self->file_res_.reset();
+                    return self->OnWrite(close, ec, 0);
+                }
+                self->WriteFileBody(close);
+            });
+            return;
+        } else {
+            // A file that shrank under us ends the body early; the peer sees a short read.
+            ec = sent < 0 ? beast::error_code{errno, boost::system::system_category()}
+                          : beast::error_code{net::error::eof};
+        }
+    }
+    file_res_.reset();
+    OnWrite(close, ec, 0);
+#else
+    if (res.length == 0) {
+        file_res_.reset();
+        return OnWrite(close, {}, 0);
+    }
+
+    beast::error_code ec;
+    res.file.seek(res.offset, ec);
+    auto chunk = std::make_shared<std::vector<char>>(static_cast<size_t>(std::min(res.length, max_chunk)));
+    const size_t read = ec ? 0 : res.file.read(chunk->data(), chunk->size(), ec);
+    if (ec || read == 0) {
+        file_res_.reset();
+        return OnWrite(true, ec ? ec : beast::error_code{net::error::eof}, 0);
+    }
+    res.offset += read;
+    res.length -= read;
+
+    net::async_write(stream_, net::buffer(chunk->data(), read),
+        [self = shared_from_this(), chunk, close](beast::error_code ec, std::size_t bytes_transferred) {
+            if (ec) {
+                self->file_res_.reset();
+                return self->OnWrite(close, ec, bytes_transferred);
+            }
+            self->WriteFileBody(close);
+        });
+#endif
 }
 
-void Session::OnWrite(beast::error_code ec, std::size_t bytes_transferred, bool close) {
+void Session::OnWrite(bool close, beast::error_code ec, std::size_t bytes_transferred) {
+    writing_ = false;
+    serializer_.reset();
+    res_.reset();
+    shared_serializer_.reset();
+    shared_res_.reset();
+    
     if (ec) {
         std::cerr << "Write error: " << ec.message() << std::endl;
+        in_flight_.clear();
+        read_done_ = true;
         return;
     }
     
     if (close) {
+        in_flight_.clear();
+        read_done_ = true;
         return stream_.socket().close();
     }
     
+    WriteNext();
+    if (writing_) {
+        return;
+    }
+    if (in_flight_.empty() && pending_upgrade_) {
+        return Upgrade();
+    }
+    if (in_flight_.empty() && read_done_ && !reading_) {
+        return stream_.socket().close();
+    }
+    
+    Read();
+}
+
+WebSocketSession::WebSocketSession(beast::tcp_stream&& stream)
+    : ws_(std::move(stream)) {
+}
+
+void WebSocketSession::Accept(Request&& req, MessageHandler on_message, CloseHandler on_close) {
+    req_ = std::move(req);
+    on_message_ = std::move(on_message);
+    on_close_ = std::move(on_close);
+    
+    ws_.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+    ws_.async_accept(req_, beast::bind_front_handler(&WebSocketSession::OnAccept, shared_from_this()));
+}
+
+void WebSocketSession::Reject(http::response<http::string_body>&& response) {
+    auto sp = std::make_shared<http::response<http::string_body>>(std::move(response));
+    sp->keep_alive(false);
+    sp->prepare_payload();
+    
+    http::async_write(ws_.next_layer(), *sp, [self = shared_from_this(), sp](beast::error_code, std::size_t) {
+        beast::error_code ec;
+        self->ws_.next_layer().socket().shutdown(tcp::socket::shutdown_send, ec);
+    });
+}
+
+void WebSocketSession::OnAccept(beast::error_code ec) {
+    if (ec) {
+        return Fail(false);
+    }
+    
+    open_ = true;
+    ws_.text(true);
+    if (!queue_.empty()) {
+        Write();
+    }
     Read();
 }
 
-Listener::Listener(net::io_context& ioc, tcp::endpoint endpoint, RequestHandler&& handler)
+void WebSocketSession::Read() {
+    ws_.async_read(buffer_, beast::bind_front_handler(&WebSocketSession::OnRead, shared_from_this()));
+}
+
+void WebSocketSession::OnRead(beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec) {
+        // While open, a write is outstanding whenever the queue is non-empty.
+        return Fail(!queue_.empty());
+    }
+    
+    const auto data = buffer_.cdata();
+    if (on_message_) {
+        on_message_({static_cast<const char*>(data.data()), data.size()});
+    }
+    buffer_.consume(buffer_.size());
+    Read();
+}
+
+void WebSocketSession::Send(std::shared_ptr<const std::string> message) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    net::post(ws_.get_executor(), [self = shared_from_this(), message = std::move(message)]() mutable {
+        if (self->closed_) {
+            self->pending_.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+        self->queue_.push_back(std::move(message));
+        if (self->open_ && self->queue_.size() == 1) {
+            self->Write();
+        }
+    });
+}
+
+void WebSocketSession::Write() {
+    ws_.async_write(net::buffer(*queue_.front()),
+        beast::bind_front_handler(&WebSocketSession::OnWrite, shared_from_this()));
+}
+
+void WebSocketSession::OnWrite(beast::error_code ec, std::size_t bytes_transferred) {
+    queue_.pop_front();
+    pending_.fetch_sub(1, std::memory_order_relaxed);
+    
+    if (ec || closed_) {
+        return Fail(false);
+    }
+    if (!queue_.empty()) {
+        Write();
+    }
+}
+
+void WebSocketSession::Fail(bool write_in_flight) {
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    // A message still being written is released by its OnWrite.
+    const auto first_idle = queue_.begin() + (write_in_flight ? 1 : 0);
+    pending_.fetch_sub(static_cast<size_t>(queue_.end() - first_idle), std::memory_order_relaxed);
+    queue_.erase(first_idle, queue_.end());
+    
+    if (auto on_close = std::move(on_close_)) {
+        on_close();
+    }
+    on_message_ = nullptr;
+}
+
+Listener::Listener(net::io_context& ioc, tcp::endpoint endpoint, RequestHandler&& handler,
+    UpgradeHandler&& upgrade_handler)
     : ioc_(ioc)
     , acceptor_(net::make_strand(ioc))
-    , handler_(std::move(handler)) {
+    , handler_(std::move(handler))
+    , upgrade_handler_(std::move(upgrade_handler)) {
     
     beast::error_code ec;
     
@@ -96,14 +407,15 @@ void Listener::OnAccept(beast::error_code ec, tcp::socket socket) {
     if (ec) {
         std::cerr << "Accept error: " << ec.message() << std::endl;
     } else {
-        std::make_shared<Session>(std::move(socket), std::move(handler_))->Run();
+        std::make_shared<Session>(std::move(socket), RequestHandler{handler_}, UpgradeHandler{upgrade_handler_})->Run();
     }
     
     DoAccept();
 }
 
-void ServeHttp(net::io_context& ioc, const tcp::endpoint& endpoint, RequestHandler&& handler) {
-    std::make_shared<Listener>(ioc, endpoint, std::move(handler))->Run();
+void ServeHttp(net::io_context& ioc, const tcp::endpoint& endpoint, RequestHandler&& handler,
+    UpgradeHandler&& upgrade_handler) {
+    std::make_shared<Listener>(ioc, endpoint, std::move(handler), std::move(upgrade_handler))->Run();
 }
 
 }  // namespace http_server
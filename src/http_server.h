@@ -3,42 +3,177 @@
 #include "sdk.h"
 
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <variant>
 
 namespace http_server {
 
 namespace net = boost::asio;
 namespace beast = boost::beast;
 namespace http = beast::http;
+namespace websocket = beast::websocket;
 using tcp = net::ip::tcp;
 
 using Request = http::request<http::string_body>;
-using RequestHandler = std::function<void(Request&&, 
-    std::function<void(http::response<http::string_body>&&)>)>;
 
+// Header plus an open file; the session writes [offset, offset + length) of the file
+// after the header, with sendfile(2) where available. length may be smaller than the
+// Content-Length in the header (HEAD requests send none of it).
+struct FileResponse {
+    http::response<http::empty_body> header;
+    beast::file file;
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+};
+
+// Response with a body shared with a cache, written straight from the shared
+// buffer instead of being copied into every response. response.body() must view
+// *body, which keeps it alive until the write is done; HEAD responses leave both
+// empty and set Content-Length themselves.
+struct SharedResponse {
+    http::response<http::span_body<const char>> response;
+    std::shared_ptr<const std::string> body;
+};
+
+class Session;
+
+// Completes the request it was handed out for, from any thread. Copying it only
+// copies a pointer to the session, so handlers can pass it around without a
+// type-erased allocation.
+class ResponseSender {
+public:
+    void operator()(http::response<http::string_body>&& response) const;
+    void operator()(FileResponse&& response) const;
+    void operator()(SharedResponse&& response) const;
+
+private:
+    friend class Session;
+
+    ResponseSender(std::shared_ptr<Session> session, std::uint64_t sequence)
+        : session_(std::move(session))
+        , sequence_(sequence) {
+    }
+
+    std::shared_ptr<Session> session_;
+    std::uint64_t sequence_;
+};
+
+using RequestHandler = std::function<void(Request&&, ResponseSender&&)>;
+
+// Server side of an upgraded connection. Text messages are queued and written in
+// order on the connection's strand; Send may be called from any thread.
+class WebSocketSession : public std::enable_shared_from_this<WebSocketSession> {
+public:
+    using MessageHandler = std::function<void(std::string_view message)>;
+    using CloseHandler = std::function<void()>;
+
+    explicit WebSocketSession(beast::tcp_stream&& stream);
+
+    // Completes the handshake for req; on_close runs once when the connection ends.
+    void Accept(Request&& req, MessageHandler on_message, CloseHandler on_close);
+    // Answers the upgrade request with a plain HTTP response and closes.
+    void Reject(http::response<http::string_body>&& response);
+
+    void Send(std::shared_ptr<const std::string> message);
+
+    // Messages queued but not yet written; lets publishers skip slow readers.
+    size_t PendingMessages() const noexcept {
+        return pending_.load(std::memory_order_relaxed);
+    }
+
+private:
+    void OnAccept(beast::error_code ec);
+    void Read();
+    void OnRead(beast::error_code ec, std::size_t bytes_transferred);
+    void Write();
+    void OnWrite(beast::error_code ec, std::size_t bytes_transferred);
+    // write_in_flight: the front of queue_ is still being written.
+    void Fail(bool write_in_flight);
+
+    websocket::stream<beast::tcp_stream> ws_;
+    beast::flat_buffer buffer_;
+    Request req_;
+    MessageHandler on_message_;
+    CloseHandler on_close_;
+    std::deque<std::shared_ptr<const std::string>> queue_;
+    std::atomic<size_t> pending_{0};
+    bool open_ = false;
+    bool closed_ = false;
+};
+
+// Receives requests that ask for a WebSocket upgrade; it must call Accept or Reject.
+using UpgradeHandler = std::function<void(Request&&, std::shared_ptr<WebSocketSession>)>;
+
+// The read buffer and the storage for the response being written and its serializer
+// live in the session and are reused for every response on the connection. Requests
+// are not: each one gets a fresh parser, and its fields and body are moved out to the
+// handler, so they are allocated anew per request.
+//
+// Pipelined requests are read while earlier ones are still being answered, up to
+// MAX_IN_FLIGHT unanswered requests; a handler may respond out of order, and the
+// responses are written in request order.
 class Session : public std::enable_shared_from_this<Session> {
 public:
-    Session(tcp::socket&& socket, RequestHandler&& handler);
+    static constexpr size_t MAX_IN_FLIGHT = 16;
+
+    Session(tcp::socket&& socket, RequestHandler&& handler, UpgradeHandler&& upgrade_handler);
     void Run();
 
 private:
+    friend class ResponseSender;
+
+    using Response = std::variant<http::response<http::string_body>, FileResponse, SharedResponse>;
+
     void Read();
     void OnRead(beast::error_code ec, std::size_t bytes_transferred);
-    void OnWrite(beast::error_code ec, std::size_t bytes_transferred, bool close);
+    void Complete(std::uint64_t sequence, Response&& response);
+    void WriteNext();
+    void Write(http::response<http::string_body>&& response);
+    void WriteFile(FileResponse&& response);
+    void WriteShared(SharedResponse&& response);
+    void OnWrite(bool close, beast::error_code ec, std::size_t bytes_transferred);
+    void WriteFileBody(bool close);
+    void Upgrade();
 
     beast::tcp_stream stream_;
     beast::flat_buffer buffer_;
-    Request req_;
+    std::optional<http::request_parser<http::string_body>> parser_;
     RequestHandler handler_;
+    UpgradeHandler upgrade_handler_;
+    std::optional<http::response<http::string_body>> res_;
+    std::optional<http::response_serializer<http::string_body>> serializer_;
+    std::optional<FileResponse> file_res_;
+    std::optional<http::response_serializer<http::empty_body>> file_serializer_;
+    // Waits for a writable socket bypass the stream's expiry; this bounds them.
+    net::steady_timer file_deadline_;
+    std::optional<SharedResponse> shared_res_;
+    std::optional<http::response_serializer<http::span_body<const char>>> shared_serializer_;
+
+    // One entry per unanswered request, oldest first; front_sequence_ belongs to
+    // the front entry. An entry stays empty until its handler responds.
+    std::deque<std::optional<Response>> in_flight_;
+    std::uint64_t front_sequence_ = 0;
+    bool reading_ = false;
+    bool writing_ = false;
+    // No more requests will be read: the peer closed, or asked to close.
+    bool read_done_ = false;
+    std::optional<Request> pending_upgrade_;
 };
 
 class Listener : public std::enable_shared_from_this<Listener> {
 public:
-    Listener(net::io_context& ioc, tcp::endpoint endpoint, RequestHandler&& handler);
+    Listener(net::io_context& ioc, tcp::endpoint endpoint, RequestHandler&& handler,
+        UpgradeHandler&& upgrade_handler);
     void Run();
 
 private:
@@ -48,8 +183,11 @@ private:
     net::io_context& ioc_;
     tcp::acceptor acceptor_;
     RequestHandler handler_;
+    UpgradeHandler upgrade_handler_;
 };
 
-void ServeHttp(net::io_context& ioc, const tcp::endpoint& endpoint, RequestHandler&& handler);
+// Without an upgrade handler, upgrade requests are passed to handler like any other.
+void ServeHttp(net::io_context& ioc, const tcp::endpoint& endpoint, RequestHandler&& handler,
+    UpgradeHandler&& upgrade_handler = {});
 
 }
@@ -41,15 +41,28 @@ void JoinHandler::HandleRequest(http::request<Body, http::basic_fields<Allocator
                          "Invalid name");
         return;
     }
-    model::Map::Id map_id{join_request->mapId};
-    const auto* map = application_.GetGame().FindMap(map_id);
-    if (!map) {
+    const auto map_index = application_.GetGame().FindMapIndex(join_request->mapId);
+    if (!map_index) {
         SendErrorResponse(std::forward<Send>(send),
                          http::status::not_found,
                          "mapNotFound",
                          "Map not found");
         return;
     }
+    // 307 keeps the method and body, so the client repeats the same join there.
+    if (const auto* owner = shard_map_ ? shard_map_->FindMapOwnerUrl(*map_index) : nullptr) {
+        json::object error_json;
+        error_json["code"] = "wrongShard";
+        error_json["message"] = "Map is hosted by another node";
+        http::response<http::string_body> res{http::status::temporary_redirect, req.version()};
+        res.set(http::field::location, *owner + std::string(req.target()));
+        res.set(http::field::content_type, "application/json");
+        res.set(http::field::cache_control, "no-cache");
+        res.body() = json::serialize(error_json);
+        res.prepare_payload();
+        send(std::move(res));
+        return;
+    }
     auto result = application_.JoinGame(join_request->userName, join_request->mapId);
     if (!result) {
         SendErrorResponse(std::forward<Send>(send),
@@ -102,8 +115,8 @@ void JoinHandler::SendErrorResponse(Send&& send, http::status status,
     send(std::move(res));
 }
 template void JoinHandler::HandleRequest<http::string_body, std::allocator<char>, 
-    std::function<void(http::response<http::string_body>&&)>>(
+    http_server::ResponseSender>(
     http::request<http::string_body, http::basic_fields<std::allocator<char>>>&&, 
-    std::function<void(http::response<http::string_body>&&)>&&);
+    http_server::ResponseSender&&);
 
 }  // namespace http_handler
@@ -3,6 +3,7 @@
 #include "http_server.h"
 #include "application.h"  
 #include "model.h"  
+#include "sharding.h"
 
 namespace http_handler {
     namespace beast = boost::beast;
@@ -10,8 +11,10 @@ namespace http_handler {
 
     class JoinHandler {  
     public:
-        explicit JoinHandler(app::Application& application)
-            : application_(application) {
+        // Joins to maps of other shards are redirected to their node.
+        explicit JoinHandler(app::Application& application, const sharding::ShardMap* shard_map = nullptr)
+            : application_(application)
+            , shard_map_(shard_map) {
         }
 
         template <typename Body, typename Allocator, typename Send>
@@ -31,6 +34,7 @@ namespace http_handler {
             std::string allow_header = "");
 
         app::Application& application_;
+        const sharding::ShardMap* shard_map_;
     };
 
 }  // namespace http_handler
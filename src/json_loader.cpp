@@ -1,7 +1,10 @@
 
 #include "json_loader.h"
-#include <fstream>
-#include <sstream>
+#include "mapped_file.h"
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
 #include <boost/json.hpp>
 
 namespace json_loader {
@@ -40,57 +43,122 @@ namespace json_loader {
             auto offset = model::Offset{ office_obj.at("offsetX").as_int64(), office_obj.at("offsetY").as_int64() };
             return model::Office{ id, pos, offset };
         }
-        void LoadMapLootTypes(const json::value& map_json, model::Map& map) {
-            if (!map_json.as_object().contains("lootTypes")) {
-                return;
+
+        model::LootGeneratorConfig ParseLootGeneratorConfig(const json::object& loot_config) {
+            const double period = loot_config.at("period").to_number<double>();
+            const double probability = loot_config.at("probability").to_number<double>();
+            if (period <= 0.0 || probability < 0.0 || probability > 1.0) {
+                throw std::invalid_argument("Invalid lootGeneratorConfig");
+            }
+            return { period, probability };
+        }
+
+        void LoadMapLootGeneratorConfig(const json::value& map_json, model::Map& map) {
+            if (map_json.as_object().contains("lootGeneratorConfig")) {
+                map.SetLootGeneratorConfig(
+                    ParseLootGeneratorConfig(map_json.at("lootGeneratorConfig").as_object()));
+            }
+        }
+
+        // The stream parser only copies tokens that straddle two chunks.
+        constexpr size_t PARSE_CHUNK_SIZE = 1 << 20;
+
+        // Takes the document as a value: the Load* helpers accept json::value, and
+        // passing them an object would copy it.
+        model::Game BuildGame(const json::value& json_value) {
+            const auto& config = json_value.as_object();
+            model::Game game;
+
+            if (config.contains("defaultDogSpeed")) {
+                game.SetDefaultDogSpeed(config.at("defaultDogSpeed").as_double());
             }
 
-            const auto& loot_types_array = map_json.at("lootTypes").as_array();
+            LoadBagCapacityConfig(json_value, game);
+            LoadLootGeneratorConfig(json_value, game);
+
+            const auto& maps_array = config.at("maps").as_array();
+            game.ReserveMaps(maps_array.size());
+            for (const auto& map_json : maps_array) {
+                const auto& map_obj = map_json.as_object();
+
+                auto map_id = model::Map::Id{ std::string(map_obj.at("id").as_string()) };
+                auto map_name = std::string(map_obj.at("name").as_string());
+
+                model::Map map{ std::move(map_id), std::move(map_name) };
+
+                if (map_obj.contains("dogSpeed")) {
+                    map.SetDogSpeed(map_obj.at("dogSpeed").as_double());
+                }
+
+                LoadMapSpecificBagCapacity(map_json, map);
+                if (!map_obj.contains("bagCapacity")) {
+                    map.SetDefaultBagCapacity(game.GetDefaultBagCapacity());
+                }
 
-            int loot_id = 0;
-            for (const auto& loot_type : loot_types_array) {
-                const auto& loot_obj = loot_type.as_object();
+                const auto& roads_array = map_obj.at("roads").as_array();
+                const auto& buildings_array = map_obj.at("buildings").as_array();
+                const auto& offices_array = map_obj.at("offices").as_array();
+                map.Reserve(roads_array.size(), buildings_array.size(), offices_array.size());
 
-                for (int i = 0; i < 3; ++i) {
-                    model::Position pos{ 10.0 + i * 5.0, 10.0 + loot_id * 3.0 };
+                for (const auto& road_json : roads_array) {
+                    map.AddRoad(ParseRoad(road_json.as_object()));
+                }
 
-                    double value = 10.0; 
-                    if (loot_obj.contains("value")) {
-                        value = loot_obj.at("value").as_double();
-                    }
+                for (const auto& building_json : buildings_array) {
+                    map.AddBuilding(ParseBuilding(building_json.as_object()));
+                }
 
-                    model::LootItem item(
-                        model::LootItem::Id{ loot_id++ },
-                        loot_id % 5 + 1, 
-                        value,
-                        pos
-                    );
-                    map.AddLootItem(std::move(item));
+                for (const auto& office_json : offices_array) {
+                    map.AddOffice(ParseOffice(office_json.as_object()));
                 }
+
+                LoadMapLootTypes(map_json, map);
+                LoadMapLootGeneratorConfig(map_json, map);
+
+                game.AddMap(std::move(map));
             }
+
+            return game;
         }
 
-        void LoadBagCapacityConfig(const json::value& config, model::Game& game) {
-            if (config.as_object().contains("defaultBagCapacity")) {
-                int default_capacity = config.at("defaultBagCapacity").as_int64();
-                game.SetDefaultBagCapacity(default_capacity);
-            }
+    }  // namespace
+
+    void LoadMapLootTypes(const json::value& map_json, model::Map& map) {
+        if (!map_json.as_object().contains("lootTypes")) {
+            return;
         }
 
-        void LoadMapSpecificBagCapacity(const json::value& map_json, model::Map& map) {
-            if (map_json.as_object().contains("bagCapacity")) {
-                int capacity = map_json.at("bagCapacity").as_int64();
-                map.SetBagCapacity(capacity);
+        // Items are spawned by the loot generator; the map only keeps what each type is worth.
+        for (const auto& loot_type : map_json.at("lootTypes").as_array()) {
+            const auto& loot_obj = loot_type.as_object();
+            double value = 10.0;
+            if (loot_obj.contains("value")) {
+                value = loot_obj.at("value").to_number<double>();
             }
+            map.AddLootType(model::LootType{ value });
         }
+    }
 
-        void LoadLootGeneratorConfig(const json::value& config, model::Game& game) {
-            if (config.as_object().contains("lootGeneratorConfig")) {
-                const auto& loot_config = config.at("lootGeneratorConfig").as_object();
-            }
+    void LoadBagCapacityConfig(const json::value& config, model::Game& game) {
+        if (config.as_object().contains("defaultBagCapacity")) {
+            int default_capacity = config.at("defaultBagCapacity").as_int64();
+            game.SetDefaultBagCapacity(default_capacity);
         }
+    }
 
-    }  // namespace
+    void LoadMapSpecificBagCapacity(const json::value& map_json, model::Map& map) {
+        if (map_json.as_object().contains("bagCapacity")) {
+            int capacity = map_json.at("bagCapacity").as_int64();
+            map.SetBagCapacity(capacity);
+        }
+    }
+
+    void LoadLootGeneratorConfig(const json::value& config, model::Game& game) {
+        if (config.as_object().contains("lootGeneratorConfig")) {
+            game.SetDefaultLootGeneratorConfig(
+                ParseLootGeneratorConfig(config.at("lootGeneratorConfig").as_object()));
+        }
+    }
 
     double LoadDogRetirementTime(const boost::json::value& config) {
         if (config.as_object().contains("dogRetirementTime")) {
@@ -99,67 +167,65 @@ namespace json_loader {
         return 60.0;
     }
 
-    model::Game LoadGame(const std::filesystem::path& json_path) {
-        std::ifstream file(json_path);
-        if (!file) {
-            throw std::runtime_error("Failed to open json file: " + json_path.string());
-        }
-
-        std::stringstream buffer;
-        buffer << file.rdbuf();
-        std::string json_content = buffer.str();
-
-        json::value json_value = json::parse(json_content);
-        const auto& config = json_value.as_object();
-
-        model::Game game;
-
-        if (config.contains("defaultDogSpeed")) {
-            game.SetDefaultDogSpeed(config.at("defaultDogSpeed").as_double());
+    std::vector<sharding::ShardConfig> LoadShards(const json::value& config) {
+        std::vector<sharding::ShardConfig> shards;
+        const auto* shards_json = config.as_object().if_contains("shards");
+        if (!shards_json) {
+            return shards;
         }
 
-        LoadBagCapacityConfig(config, game);
-        LoadLootGeneratorConfig(config, game);
-
-        const auto& maps_array = config.at("maps").as_array();
-        for (const auto& map_json : maps_array) {
-            const auto& map_obj = map_json.as_object();
-
-            auto map_id = model::Map::Id{ std::string(map_obj.at("id").as_string()) };
-            auto map_name = std::string(map_obj.at("name").as_string());
-
-            model::Map map{ map_id, map_name };
-
-            if (map_obj.contains("dogSpeed")) {
-                map.SetDogSpeed(map_obj.at("dogSpeed").as_double());
-            }
-
-            LoadMapSpecificBagCapacity(map_json, map);
-            if (!map_obj.contains("bagCapacity")) {
-                map.SetDefaultBagCapacity(game.GetDefaultBagCapacity());
-            }
-
-            const auto& roads_array = map_obj.at("roads").as_array();
-            for (const auto& road_json : roads_array) {
-                map.AddRoad(ParseRoad(road_json.as_object()));
-            }
-
-            const auto& buildings_array = map_obj.at("buildings").as_array();
-            for (const auto& building_json : buildings_array) {
-                map.AddBuilding(ParseBuilding(building_json.as_object()));
+        for (const auto& shard_json : shards_json->as_array()) {
+            const auto& shard_obj = shard_json.as_object();
+            const auto id = shard_obj.at("id").as_int64();
+            if (id < 0 || id > std::numeric_limits<uint8_t>::max()) {
+                throw std::invalid_argument("Shard id out of range: " + std::to_string(id));
             }
 
-            const auto& offices_array = map_obj.at("offices").as_array();
-            for (const auto& office_json : offices_array) {
-                map.AddOffice(ParseOffice(office_json.as_object()));
+            sharding::ShardConfig shard{ static_cast<uint8_t>(id), std::string(shard_obj.at("url").as_string()), {} };
+            for (const auto& map_id : shard_obj.at("maps").as_array()) {
+                shard.map_ids.emplace_back(map_id.as_string());
             }
+            shards.push_back(std::move(shard));
+        }
+        return shards;
+    }
 
-            LoadMapLootTypes(map_json, map);
+    LoadedConfig LoadConfig(const std::filesystem::path& json_path) {
+        using Clock = std::chrono::steady_clock;
+        LoadTimings timings;
 
-            game.AddMap(std::move(map));
+        auto started_at = Clock::now();
+        std::optional<util::MappedFile> file;
+        try {
+            file.emplace(json_path);
+        }
+        catch (const std::system_error& e) {
+            throw std::runtime_error("Failed to open json file: " + json_path.string() + ": " + e.what());
         }
+        const auto bytes = file->Bytes();
+        timings.map = Clock::now() - started_at;
+
+        // The document is only read while building the game, and dropped as a whole
+        // afterwards; an arena sized like the file avoids per-node allocations.
+        started_at = Clock::now();
+        json::monotonic_resource resource{ bytes.size() };
+        json::stream_parser parser;
+        parser.reset(&resource);
+        for (size_t offset = 0; offset < bytes.size(); offset += PARSE_CHUNK_SIZE) {
+            parser.write(bytes.substr(offset, PARSE_CHUNK_SIZE));
+        }
+        parser.finish();
+        const json::value json_value = parser.release();
+        timings.parse = Clock::now() - started_at;
+
+        started_at = Clock::now();
+        LoadedConfig loaded{ BuildGame(json_value), LoadDogRetirementTime(json_value), timings, LoadShards(json_value) };
+        loaded.timings.build = Clock::now() - started_at;
+        return loaded;
+    }
 
-        return game;
+    model::Game LoadGame(const std::filesystem::path& json_path) {
+        return std::move(LoadConfig(json_path).game);
     }
 
 }  // namespace json_loader
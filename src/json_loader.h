@@ -1,18 +1,38 @@
-
 #pragma once
 
+#include <chrono>
 #include <filesystem>
 #include <boost/json.hpp>
 
 #include "model.h"
+#include "sharding.h"
 
 namespace json_loader {
 
+	// Wall time of each loading phase: mapping the file, parsing it, building the game.
+	struct LoadTimings {
+		std::chrono::nanoseconds map{};
+		std::chrono::nanoseconds parse{};
+		std::chrono::nanoseconds build{};
+	};
+
+	struct LoadedConfig {
+		model::Game game;
+		double dog_retirement_time_seconds;
+		LoadTimings timings;
+		// Empty unless the config has a "shards" section.
+		std::vector<sharding::ShardConfig> shards;
+	};
+
+	// Reads the config in a single pass: the file is memory-mapped and fed in chunks
+	// to a stream parser whose document lives in one monotonic arena.
+	LoadedConfig LoadConfig(const std::filesystem::path& json_path);
 	model::Game LoadGame(const std::filesystem::path& json_path);
 	void LoadMapLootTypes(const boost::json::value& map_json, model::Map& map);
 	void LoadBagCapacityConfig(const boost::json::value& config, model::Game& game);
 	void LoadLootGeneratorConfig(const boost::json::value& config, model::Game& game);
 	void LoadMapSpecificBagCapacity(const boost::json::value& map_json, model::Map& map);
 	double LoadDogRetirementTime(const boost::json::value& config);
+	std::vector<sharding::ShardConfig> LoadShards(const boost::json::value& config);
 
 }  // namespace json_loader
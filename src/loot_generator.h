@@ -0,0 +1,26 @@
+#pragma once
+#include <chrono>
+
+namespace loot_gen {
+
+    // Decides how many items to spawn on a map per tick. The longer a map goes
+    // without a spawn, the likelier one becomes: over base_interval the chance is
+    // probability, and the count never lifts loot above the number of looters.
+    class LootGenerator {
+    public:
+        using TimeInterval = std::chrono::milliseconds;
+
+        LootGenerator(TimeInterval base_interval, double probability)
+            : base_interval_{ base_interval }
+            , probability_{ probability } {
+        }
+
+        unsigned Generate(TimeInterval time_delta, unsigned loot_count, unsigned looter_count);
+
+    private:
+        TimeInterval base_interval_;
+        double probability_;
+        TimeInterval time_without_loot_{};
+    };
+
+}  // namespace loot_gen
@@ -8,13 +8,15 @@
 #include <iostream>
 #include <thread>
 #include <cstdlib>
-#include <fstream>
-#include <sstream>
-#include <boost/json.hpp>
+#include <limits>
 
 #include "json_loader.h"
 #include "request_handler.h"
+#include "state_updates.h"
 #include "application.h"
+#include "mapped_file.h"
+#include "sharding.h"
+#include "state_file.h"
 
 using namespace std::literals;
 namespace net = boost::asio;
@@ -38,7 +40,14 @@ struct Config {
     std::string config_file;
     std::string www_root;
     std::optional<int> tick_period;
+    unsigned max_catch_up_ticks = 4;
+    int db_wait_timeout = 2000;
     bool randomize_spawn_points = false;
+    bool metrics_enabled = true;
+    std::optional<uint64_t> random_seed;
+    std::optional<std::string> state_file;
+    std::optional<int> save_state_period;
+    std::optional<unsigned> shard;
 };
 
 std::optional<Config> ParseCommandLine(int argc, const char* argv[]) {
@@ -46,9 +55,16 @@ std::optional<Config> ParseCommandLine(int argc, const char* argv[]) {
     desc.add_options()
         ("help,h", "produce help message")
         ("tick-period,t", po::value<int>(), "set tick period")
+        ("max-catch-up-ticks", po::value<unsigned>()->default_value(4), "ticks run back to back after a late wake-up before the rest are skipped")
+        ("db-wait-timeout", po::value<int>()->default_value(2000), "milliseconds to wait for a free database connection")
         ("config-file,c", po::value<std::string>()->required(), "set config file path")
         ("www-root,w", po::value<std::string>()->required(), "set static files root")
         ("randomize-spawn-points", "spawn dogs at random positions")
+        ("no-metrics", "disable tick and request timers")
+        ("random-seed", po::value<uint64_t>(), "seed spawn points and loot, to replay a run")
+        ("state-file", po::value<std::string>(), "restore game state from this file and save it there on shutdown")
+        ("save-state-period", po::value<int>(), "also save game state every this many milliseconds of game time")
+        ("shard", po::value<unsigned>(), "id of this node among the shards of the config; required when it has any")
     ;
 
     po::variables_map vm;
@@ -75,9 +91,32 @@ std::optional<Config> ParseCommandLine(int argc, const char* argv[]) {
         config.tick_period = vm["tick-period"].as<int>();
     }
     
+    config.max_catch_up_ticks = vm["max-catch-up-ticks"].as<unsigned>();
+    config.db_wait_timeout = std::max(1, vm["db-wait-timeout"].as<int>());
+
     if (vm.count("randomize-spawn-points")) {
         config.randomize_spawn_points = true;
     }
+
+    if (vm.count("no-metrics")) {
+        config.metrics_enabled = false;
+    }
+
+    if (vm.count("random-seed")) {
+        config.random_seed = vm["random-seed"].as<uint64_t>();
+    }
+
+    if (vm.count("state-file")) {
+        config.state_file = vm["state-file"].as<std::string>();
+    }
+
+    if (vm.count("save-state-period")) {
+        config.save_state_period = vm["save-state-period"].as<int>();
+    }
+
+    if (vm.count("shard")) {
+        config.shard = vm["shard"].as<unsigned>();
+    }
     
     return config;
 }
@@ -93,19 +132,60 @@ int main(int argc, const char* argv[]) {
     auto config = *config_opt;
     
     try {
-        std::ifstream config_file(config.config_file);
-        if (!config_file) {
-            throw std::runtime_error("Failed to open config file: " + config.config_file);
+        auto loaded = json_loader::LoadConfig(config.config_file);
+        {
+            using Ms = std::chrono::duration<double, std::milli>;
+            const auto& timings = loaded.timings;
+            std::cout << "Config loaded in " << Ms(timings.map + timings.parse + timings.build).count() << "ms"
+                << " (map " << Ms(timings.map).count() << "ms, parse " << Ms(timings.parse).count()
+                << "ms, build " << Ms(timings.build).count() << "ms, "
+                << loaded.game.GetMaps().size() << " maps)" << std::endl;
+        }
+
+        model::Game& game = loaded.game;
+        app::Application application{game, config.randomize_spawn_points, loaded.dog_retirement_time_seconds, config.random_seed};
+        application.GetMetrics().SetEnabled(config.metrics_enabled);
+
+        sharding::ShardMap shard_map;
+        if (!loaded.shards.empty()) {
+            if (!config.shard || *config.shard > std::numeric_limits<uint8_t>::max()) {
+                throw std::runtime_error("The config is sharded: --shard must name this node's shard id");
+            }
+            shard_map = sharding::ShardMap{ game, loaded.shards, static_cast<uint8_t>(*config.shard) };
+            application.SetTokenShard(shard_map.GetLocalShard());
+        } else if (config.shard) {
+            throw std::runtime_error("--shard needs a \"shards\" section in the config");
         }
-        std::stringstream buffer;
-        buffer << config_file.rdbuf();
-        boost::json::value json_value = boost::json::parse(buffer.str());
-        double dog_retirement_time = json_loader::LoadDogRetirementTime(json_value);
 
-        model::Game game = json_loader::LoadGame(config.config_file);
-        app::Application application{game, config.randomize_spawn_points, dog_retirement_time};
+        // A missing or unreadable state is not fatal: the server then starts empty.
+        std::unique_ptr<app::state_file::StateFileWriter> state_writer;
+        if (config.state_file) {
+            if (std::filesystem::exists(*config.state_file)) {
+                try {
+                    const auto started_at = std::chrono::steady_clock::now();
+                    util::MappedFile state{ *config.state_file };
+                    const size_t restored = application.RestoreState(state.Bytes());
+                    const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - started_at;
+                    std::cout << "Restored " << restored << " players from " << *config.state_file
+                        << " in " << took.count() << "ms" << std::endl;
+                } catch (const std::exception& e) {
+                    std::cerr << "Failed to restore game state: " << e.what() << std::endl;
+                }
+            }
+
+            state_writer = std::make_unique<app::state_file::StateFileWriter>(*config.state_file);
+            if (config.save_state_period) {
+                application.SetStateSaver(std::chrono::milliseconds(*config.save_state_period),
+                    [&state_writer](std::string state) {
+                        state_writer->Submit(std::move(state));
+                    });
+            }
+        }
         
         net::io_context ioc(std::max(1u, std::thread::hardware_concurrency()));
+        application.SetTaskPoster([&ioc](std::function<void()> task) {
+            net::post(ioc, std::move(task));
+        });
 
         net::signal_set signals(ioc, SIGINT, SIGTERM);
         signals.async_wait([&ioc](const boost::system::error_code& ec, int signal_number) {
@@ -121,34 +201,67 @@ int main(int argc, const char* argv[]) {
         }
 
         const unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+        app::db::ConnectionPool::Settings pool_settings;
+        pool_settings.wait_timeout = std::chrono::milliseconds{ config.db_wait_timeout };
         app::db::ConnectionPool conn_pool{num_threads, [db_url] {
             return std::make_shared<pqxx::connection>(db_url);
-        }};
+        }, pool_settings, num_threads, &application.GetMetrics()};
 
-        app::db::Database database{conn_pool};
+        // Every shard writes to the same records table, so a node's own cache of the
+        // top would miss the others' records; sharded nodes query the table directly.
+        app::db::Database database{conn_pool, shard_map.IsSharded() ? size_t{ 0 } : size_t{ 10000 }};
         database.Initialize();
 
-        application.SetRetirementCallback([&database](const std::string& name, int score, double play_time_seconds) {
-            database.AddRetiredPlayer(name, score, play_time_seconds);
+        app::db::RetiredPlayerWriter retired_player_writer{database, &application.GetMetrics()};
+        application.SetRetirementCallback([&retired_player_writer](const std::string& name, int score, double play_time_seconds) {
+            retired_player_writer.Enqueue({name, score, play_time_seconds});
+        });
+
+        // The game belongs to game_strand on its own thread, so a burst of requests
+        // does not delay ticks. Joins, the tick endpoint, manual actions and the
+        // snapshot rebuilds they trigger all run there; the io_context workers only
+        // read published snapshots and the token index, and queue auto mode actions.
+        net::io_context tick_ioc;
+        auto tick_work = net::make_work_guard(tick_ioc);
+        auto game_strand = net::make_strand(tick_ioc);
+        application.SetGameTaskPoster([game_strand](std::function<void()> task) {
+            net::post(game_strand, std::move(task));
         });
+        std::jthread tick_thread{ [&tick_ioc] {
+            tick_ioc.run();
+        } };
 
-        auto api_strand = net::make_strand(ioc);
-        http_handler::RequestHandler handler{application, api_strand, config.tick_period.has_value(), database};
+        http_handler::RequestHandler handler{application, game_strand, config.tick_period.has_value(), &database,
+            config.www_root, &shard_map};
 
         const auto address = net::ip::make_address("0.0.0.0");
         constexpr unsigned short port = 8080;
         
+        http_handler::StateUpdates state_updates{application};
+        application.SetSnapshotListener([&state_updates](size_t map_index, std::shared_ptr<const app::MapSnapshot> snapshot) {
+            state_updates.Publish(map_index, std::move(snapshot));
+        });
+        
         http_server::ServeHttp(ioc, {address, port}, [&handler](auto&& req, auto&& send) {
             handler(std::forward<decltype(req)>(req), std::forward<decltype(send)>(send));
+        }, [&state_updates](http_server::Request&& req, std::shared_ptr<http_server::WebSocketSession> session) {
+            state_updates.HandleUpgrade(std::move(req), std::move(session));
         });
         
         std::shared_ptr<Ticker> ticker;
         if (config.tick_period) {
             auto period = std::chrono::milliseconds(*config.tick_period);
-            ticker = std::make_shared<Ticker>(api_strand, period,
+            application.GetMetrics().SetTickPeriod(period);
+            ticker = std::make_shared<Ticker>(game_strand, period,
                 [&application](std::chrono::milliseconds delta) {
-                    application.Tick(delta);
-                }
+                    try {
+                        application.Tick(delta);
+                    } catch (...) {
+                        application.GetMetrics().CountTickFailure();
+                        throw;
+                    }
+                },
+                config.max_catch_up_ticks, &application.GetMetrics()
             );
             ticker->Start();
             std::cout << "Auto-tick mode enabled with period: " << *config.tick_period << "ms" << std::endl;
@@ -161,6 +274,15 @@ int main(int argc, const char* argv[]) {
         } else {
             std::cout << "Fixed spawn points enabled" << std::endl;
         }
+        std::cout << "Random seed: " << application.GetRandomSeed() << std::endl;
+        if (shard_map.IsSharded()) {
+            size_t local_maps = 0;
+            for (size_t i = 0; i < game.GetMaps().size(); ++i) {
+                local_maps += shard_map.IsLocal(static_cast<model::MapIndex>(i));
+            }
+            std::cout << "Shard " << unsigned{ shard_map.GetLocalShard() } << " owns " << local_maps
+                << " of " << game.GetMaps().size() << " maps" << std::endl;
+        }
 
         std::cout << "Server has started..."sv << std::endl;
         std::cout << "Config file: " << config.config_file << std::endl;
@@ -175,6 +297,16 @@ int main(int argc, const char* argv[]) {
         if (ticker) {
             ticker->Stop();
         }
+        tick_work.reset();
+        tick_thread.join();
+        retired_player_writer.Stop();
+        // After the writer's last flush, which still needs a connection.
+        conn_pool.Stop();
+
+        if (state_writer) {
+            state_writer->Submit(application.SaveState());
+            state_writer->Stop();
+        }
         
         std::cout << "Server shutdown complete" << std::endl;
     } catch (const std::exception& ex) {
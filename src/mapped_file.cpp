@@ -0,0 +1,47 @@
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace util {
+
+MappedFile::MappedFile(const std::filesystem::path& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + path.string());
+    }
+
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "Failed to stat " + path.string());
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    void* data = size_ == 0 ? nullptr : ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    const int error = errno;
+    // The mapping keeps the file alive on its own.
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw std::system_error(error, std::generic_category(), "Failed to map " + path.string());
+    }
+    if (data) {
+        ::madvise(data, size_, MADV_SEQUENTIAL);
+    }
+    data_ = data;
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        ::munmap(data_, size_);
+    }
+}
+
+}  // namespace util
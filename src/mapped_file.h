@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+namespace util {
+
+// Read-only, read-ahead mapping of a whole file. Throws std::system_error when the
+// file cannot be opened or mapped; an empty file maps to an empty view.
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view Bytes() const noexcept {
+        return { static_cast<const char*>(data_), size_ };
+    }
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+}  // namespace util
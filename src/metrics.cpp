@@ -0,0 +1,220 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <utility>
+
+namespace metrics {
+
+    using namespace std::literals;
+
+    namespace {
+
+        constexpr std::array<std::string_view, 8> PHASE_NAMES{
+            "actions"sv, "movement"sv, "collision"sv, "loot_generation"sv,
+            "retirement"sv, "db_callback"sv, "snapshot"sv, "state_save"sv,
+        };
+
+        constexpr std::array<std::string_view, 10> ROUTE_NAMES{
+            "join"sv, "players"sv, "state"sv, "action"sv, "actions"sv, "tick"sv,
+            "records"sv, "maps"sv, "metrics"sv, "other"sv,
+        };
+
+        constexpr std::array<std::string_view, 3> COLLISION_EVENT_NAMES{
+            "pickup"sv, "office_return"sv, "skip"sv,
+        };
+
+        constexpr std::array<double, 5> QUANTILES{ 0.5, 0.9, 0.99, 0.999, 1.0 };
+
+        void AppendNumber(std::string& out, double value) {
+            char buffer[32];
+            auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            out.append(buffer, ec == std::errc{} ? end : buffer);
+        }
+
+        void AppendNumber(std::string& out, uint64_t value) {
+            char buffer[24];
+            auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            out.append(buffer, ec == std::errc{} ? end : buffer);
+        }
+
+        void AppendHeader(std::string& out, std::string_view name, std::string_view type, std::string_view help) {
+            out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+            out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+        }
+
+        // label is either empty or a complete `key="value"` pair.
+        void AppendSummary(std::string& out, std::string_view name, std::string_view label,
+            const LatencyHistogram& histogram) {
+            for (double q : QUANTILES) {
+                out.append(name).append("{");
+                if (!label.empty()) {
+                    out.append(label).append(",");
+                }
+                out.append("quantile=\"");
+                AppendNumber(out, q);
+                out.append("\"} ");
+                AppendNumber(out, histogram.QuantileSeconds(q));
+                out.append("\n");
+            }
+
+            const std::string labels = label.empty() ? std::string{} : "{" + std::string(label) + "}";
+            out.append(name).append("_sum").append(labels).append(" ");
+            AppendNumber(out, histogram.SumSeconds());
+            out.append("\n");
+            out.append(name).append("_count").append(labels).append(" ");
+            AppendNumber(out, histogram.Count());
+            out.append("\n");
+        }
+
+    }  // namespace
+
+    void LatencyHistogram::Record(std::chrono::nanoseconds value) noexcept {
+        const uint64_t ns = value.count() > 0 ? static_cast<uint64_t>(value.count()) : 0;
+        buckets_[BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    double LatencyHistogram::QuantileSeconds(double q) const noexcept {
+        const uint64_t count = Count();
+        if (count == 0) {
+            return 0.0;
+        }
+
+        // Buckets may be a few records ahead of count_; the last non-empty one is
+        // the answer if the rank is never reached.
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+        uint64_t seen = 0;
+        size_t last = 0;
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+            const uint64_t n = buckets_[bucket].load(std::memory_order_relaxed);
+            if (n == 0) {
+                continue;
+            }
+            last = bucket;
+            seen += n;
+            if (seen >= rank) {
+                break;
+            }
+        }
+        return BucketMidpoint(last) / 1e9;
+    }
+
+    size_t LatencyHistogram::BucketOf(uint64_t ns) noexcept {
+        if (ns < SUB_BUCKETS) {
+            return static_cast<size_t>(ns);
+        }
+        const unsigned magnitude = std::bit_width(ns) - 1;
+        const unsigned shift = magnitude - SUB_BUCKET_BITS;
+        const uint64_t sub = (ns >> shift) & (SUB_BUCKETS - 1);
+        return (shift + 1) * SUB_BUCKETS + sub;
+    }
+
+    double LatencyHistogram::BucketMidpoint(size_t bucket) noexcept {
+        if (bucket < SUB_BUCKETS) {
+            return static_cast<double>(bucket);
+        }
+        const unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS) - 1;
+        const double lower = std::ldexp(static_cast<double>(SUB_BUCKETS + bucket % SUB_BUCKETS), shift);
+        return lower + std::ldexp(0.5, shift);
+    }
+
+    Route ClassifyRoute(std::string_view target) noexcept {
+        constexpr std::array<std::pair<std::string_view, Route>, 9> prefixes{ {
+            { "/api/v1/game/join"sv, Route::Join },
+            { "/api/v1/game/players"sv, Route::Players },
+            { "/api/v1/game/state"sv, Route::State },
+            { "/api/v1/game/player/actions"sv, Route::Actions },
+            { "/api/v1/game/player/action"sv, Route::Action },
+            { "/api/v1/game/tick"sv, Route::Tick },
+            { "/api/v1/game/records"sv, Route::Records },
+            { "/api/v1/maps"sv, Route::Maps },
+            { "/api/v1/metrics"sv, Route::Metrics },
+        } };
+
+        for (const auto& [prefix, route] : prefixes) {
+            if (target.starts_with(prefix)) {
+                return route;
+            }
+        }
+        return Route::Other;
+    }
+
+    void Registry::RecordTick(std::chrono::nanoseconds duration) noexcept {
+        if (!Enabled()) {
+            return;
+        }
+        ticks_.Record(duration);
+        const int64_t period = tick_period_ns_.load(std::memory_order_relaxed);
+        if (period > 0 && duration.count() > period) {
+            tick_overruns_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::string Registry::RenderPrometheus() const {
+        std::string out;
+        out.reserve(8 * 1024);
+
+        AppendHeader(out, "game_server_metrics_enabled", "gauge", "Whether timers are currently recording.");
+        out.append("game_server_metrics_enabled ").append(Enabled() ? "1" : "0").append("\n");
+
+        AppendHeader(out, "game_server_tick_duration_seconds", "summary", "Wall time of a whole game tick.");
+        AppendSummary(out, "game_server_tick_duration_seconds", {}, ticks_);
+
+        AppendHeader(out, "game_server_tick_phase_seconds", "summary",
+            "Time spent in a tick phase; per-map phases are recorded once per map.");
+        for (size_t i = 0; i < PHASE_COUNT; ++i) {
+            AppendSummary(out, "game_server_tick_phase_seconds", "phase=\"" + std::string(PHASE_NAMES[i]) + "\"", phases_[i]);
+        }
+
+        AppendHeader(out, "game_server_tick_jitter_seconds", "summary", "How late the ticker woke up for each tick deadline.");
+        AppendSummary(out, "game_server_tick_jitter_seconds", {}, tick_jitter_);
+
+        AppendHeader(out, "game_server_ticks_skipped_total", "counter", "Ticks dropped beyond the catch-up limit.");
+        out.append("game_server_ticks_skipped_total ");
+        AppendNumber(out, ticks_skipped_.load(std::memory_order_relaxed));
+        out.append("\n");
+
+        AppendHeader(out, "game_server_tick_overruns_total", "counter", "Ticks that took longer than the tick period.");
+        out.append("game_server_tick_overruns_total ");
+        AppendNumber(out, tick_overruns_.load(std::memory_order_relaxed));
+        out.append("\n");
+
+        AppendHeader(out, "game_server_tick_failures_total", "counter", "Ticks aborted by an exception.");
+        out.append("game_server_tick_failures_total ");
+        AppendNumber(out, tick_failures_.load(std::memory_order_relaxed));
+        out.append("\n");
+
+        AppendHeader(out, "game_server_db_pool_wait_seconds", "summary", "Time spent waiting for a free database connection.");
+        AppendSummary(out, "game_server_db_pool_wait_seconds", {}, db_pool_wait_);
+
+        AppendHeader(out, "game_server_db_pool_timeouts_total", "counter", "Database connection waits that gave up without a connection.");
+        out.append("game_server_db_pool_timeouts_total ");
+        AppendNumber(out, db_pool_timeouts_.load(std::memory_order_relaxed));
+        out.append("\n");
+
+        AppendHeader(out, "game_server_retired_players_dropped_total", "counter",
+            "Retired players never written because the database stayed unavailable.");
+        out.append("game_server_retired_players_dropped_total ");
+        AppendNumber(out, retired_players_dropped_.load(std::memory_order_relaxed));
+        out.append("\n");
+
+        AppendHeader(out, "game_server_collision_events_total", "counter", "Resolved collision events by type.");
+        for (size_t i = 0; i < collision_events_.size(); ++i) {
+            out.append("game_server_collision_events_total{type=\"").append(COLLISION_EVENT_NAMES[i]).append("\"} ");
+            AppendNumber(out, collision_events_[i].load(std::memory_order_relaxed));
+            out.append("\n");
+        }
+
+        AppendHeader(out, "game_server_api_request_seconds", "summary", "API handler latency by route.");
+        for (size_t i = 0; i < ROUTE_COUNT; ++i) {
+            AppendSummary(out, "game_server_api_request_seconds", "route=\"" + std::string(ROUTE_NAMES[i]) + "\"", routes_[i]);
+        }
+
+        return out;
+    }
+
+}  // namespace metrics
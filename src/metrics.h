@@ -0,0 +1,198 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Build with -DGAME_SERVER_METRICS=0 to compile every timer down to nothing.
+#ifndef GAME_SERVER_METRICS
+#define GAME_SERVER_METRICS 1
+#endif
+
+namespace metrics {
+
+    // Log-linear latency histogram in the HDR style: each power-of-two range of
+    // nanoseconds is split into SUB_BUCKETS equal buckets, so a reported quantile is
+    // within 1/SUB_BUCKETS of the recorded value at any magnitude. Record is a couple
+    // of relaxed atomic increments and may be called from any thread.
+    class LatencyHistogram {
+    public:
+        void Record(std::chrono::nanoseconds value) noexcept;
+
+        uint64_t Count() const noexcept {
+            return count_.load(std::memory_order_relaxed);
+        }
+
+        double SumSeconds() const noexcept {
+            return sum_ns_.load(std::memory_order_relaxed) / 1e9;
+        }
+
+        // q in [0, 1]; 0 when nothing has been recorded.
+        double QuantileSeconds(double q) const noexcept;
+
+    private:
+        static constexpr unsigned SUB_BUCKET_BITS = 3;
+        static constexpr uint64_t SUB_BUCKETS = uint64_t{ 1 } << SUB_BUCKET_BITS;
+        static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        static size_t BucketOf(uint64_t ns) noexcept;
+        static double BucketMidpoint(size_t bucket) noexcept;
+
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_{};
+        std::atomic<uint64_t> count_{ 0 };
+        std::atomic<uint64_t> sum_ns_{ 0 };
+    };
+
+    // Movement is the vectorized pass over all dogs; Collision is the per-map pass
+    // that clamps dogs to the roads and resolves loot and office hits.
+    enum class Phase {
+        Actions,
+        Movement,
+        Collision,
+        LootGeneration,
+        Retirement,
+        DbCallback,
+        Snapshot,
+        StateSave,
+    };
+
+    enum class Route {
+        Join,
+        Players,
+        State,
+        Action,
+        Actions,
+        Tick,
+        Records,
+        Maps,
+        Metrics,
+        Other,
+    };
+
+    Route ClassifyRoute(std::string_view target) noexcept;
+
+    class Registry;
+
+    // Records the time from construction to destruction; inert when metrics are off.
+    class ScopedTimer {
+    public:
+        ScopedTimer(const Registry& registry, LatencyHistogram& histogram) noexcept;
+        ~ScopedTimer();
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        LatencyHistogram* histogram_;
+        Clock::time_point start_;
+    };
+
+    // Process-wide tick and API instrumentation, rendered in the Prometheus text format.
+    class Registry {
+    public:
+        bool Enabled() const noexcept {
+            return GAME_SERVER_METRICS && enabled_.load(std::memory_order_relaxed);
+        }
+
+        void SetEnabled(bool enabled) noexcept {
+            enabled_.store(enabled, std::memory_order_relaxed);
+        }
+
+        // A tick that runs longer than the period is counted as an overrun.
+        void SetTickPeriod(std::chrono::milliseconds period) noexcept {
+            tick_period_ns_.store(std::chrono::nanoseconds{ period }.count(), std::memory_order_relaxed);
+        }
+
+        // Safe from any thread; per-map phases record once per map and tick.
+        ScopedTimer Time(Phase phase) noexcept {
+            return { *this, phases_[static_cast<size_t>(phase)] };
+        }
+
+        // Routes are timed until the response is sent, which may be on another thread
+        // than the one that took the request.
+        void RecordRoute(Route route, std::chrono::nanoseconds duration) noexcept {
+            if (Enabled()) {
+                routes_[static_cast<size_t>(route)].Record(duration);
+            }
+        }
+
+        void RecordTick(std::chrono::nanoseconds duration) noexcept;
+
+        // How late the ticker woke up for a tick deadline.
+        void RecordTickJitter(std::chrono::nanoseconds lateness) noexcept {
+            if (Enabled()) {
+                tick_jitter_.Record(lateness);
+            }
+        }
+
+        // Ticks the ticker dropped because it was further behind than its catch-up limit.
+        void CountSkippedTicks(uint64_t count) noexcept {
+            ticks_skipped_.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        // Time a caller waited for a database connection; failed waits timed out or
+        // were aborted by shutdown.
+        void RecordDbPoolWait(std::chrono::nanoseconds wait, bool failed) noexcept {
+            if (Enabled()) {
+                db_pool_wait_.Record(wait);
+            }
+            if (failed) {
+                db_pool_timeouts_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void CountTickFailure() noexcept {
+            tick_failures_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void CountCollisionEvents(uint64_t pickups, uint64_t returns, uint64_t skips) noexcept {
+            collision_events_[0].fetch_add(pickups, std::memory_order_relaxed);
+            collision_events_[1].fetch_add(returns, std::memory_order_relaxed);
+            collision_events_[2].fetch_add(skips, std::memory_order_relaxed);
+        }
+
+        // Retired players the write-behind queue gave up on.
+        void CountDroppedRetiredPlayers(uint64_t count) noexcept {
+            retired_players_dropped_.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        std::string RenderPrometheus() const;
+
+    private:
+        static constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::StateSave) + 1;
+        static constexpr size_t ROUTE_COUNT = static_cast<size_t>(Route::Other) + 1;
+
+        std::atomic<bool> enabled_{ true };
+        std::atomic<int64_t> tick_period_ns_{ 0 };
+        std::array<LatencyHistogram, PHASE_COUNT> phases_;
+        std::array<LatencyHistogram, ROUTE_COUNT> routes_;
+        LatencyHistogram ticks_;
+        LatencyHistogram tick_jitter_;
+        std::atomic<uint64_t> ticks_skipped_{ 0 };
+        std::atomic<uint64_t> tick_overruns_{ 0 };
+        std::atomic<uint64_t> tick_failures_{ 0 };
+        LatencyHistogram db_pool_wait_;
+        std::atomic<uint64_t> db_pool_timeouts_{ 0 };
+        std::atomic<uint64_t> retired_players_dropped_{ 0 };
+        // Pickups, office returns and skipped pickups.
+        std::array<std::atomic<uint64_t>, 3> collision_events_{};
+    };
+
+    inline ScopedTimer::ScopedTimer(const Registry& registry, LatencyHistogram& histogram) noexcept
+        : histogram_(registry.Enabled() ? &histogram : nullptr) {
+        if (histogram_) {
+            start_ = Clock::now();
+        }
+    }
+
+    inline ScopedTimer::~ScopedTimer() {
+        if (histogram_) {
+            histogram_->Record(Clock::now() - start_);
+        }
+    }
+
+}  // namespace metrics
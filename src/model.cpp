@@ -2,6 +2,8 @@
 #include "model.h"
 #include <stdexcept>
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
 namespace model {
     using namespace std::literals;
@@ -15,27 +17,229 @@ namespace model {
         Office& o = offices_.emplace_back(std::move(office));
         try {
             office_id_to_index_.emplace(o.GetId(), index);
+            office_index_.Insert(index, o.GetPosition().x, o.GetPosition().y);
         }
         catch (...) {
+            office_id_to_index_.erase(o.GetId());
             offices_.pop_back();
             throw;
         }
     }
 
+    void Map::AddLootItem(LootItem item) {
+        if (loot_id_to_index_.contains(item.GetId())) {
+            throw std::invalid_argument("Duplicate loot item");
+        }
+
+        const size_t index = loot_items_.size();
+        LootItem& l = loot_items_.emplace_back(std::move(item));
+        try {
+            loot_id_to_index_.emplace(l.GetId(), index);
+            loot_index_.Insert(l.GetId(), l.GetPosition().x, l.GetPosition().y);
+        }
+        catch (...) {
+            loot_id_to_index_.erase(l.GetId());
+            loot_items_.pop_back();
+            throw;
+        }
+    }
+
+    void Map::RemoveLootItem(const LootItem::Id& id) {
+        auto it = loot_id_to_index_.find(id);
+        if (it == loot_id_to_index_.end()) {
+            return;
+        }
+
+        const size_t index = it->second;
+        const auto position = loot_items_[index].GetPosition();
+        loot_index_.Erase(id, position.x, position.y);
+        loot_id_to_index_.erase(it);
+
+        // Swap-and-pop: the last item takes the freed slot, so only its index entry changes.
+        if (index + 1 != loot_items_.size()) {
+            loot_items_[index] = std::move(loot_items_.back());
+            loot_id_to_index_[loot_items_[index].GetId()] = index;
+        }
+        loot_items_.pop_back();
+    }
+
+    Position Map::GetRandomRoadPosition(util::Xoshiro256& gen) const {
+        if (roads_.empty()) {
+            return { 0.0, 0.0 };
+        }
+
+        const double total = GetTotalRoadLength();
+        size_t index = 0;
+        double offset = 0.0;
+        if (total > 0.0) {
+            const double u = std::uniform_real_distribution<double>(0.0, total)(gen);
+            const auto it = std::upper_bound(road_length_prefix_.begin(), road_length_prefix_.end(), u);
+            index = std::min<size_t>(it - road_length_prefix_.begin(), roads_.size() - 1);
+            offset = u - (index == 0 ? 0.0 : road_length_prefix_[index - 1]);
+        }
+        else {
+            // Only zero-length roads: every one is a single point.
+            index = std::uniform_int_distribution<size_t>(0, roads_.size() - 1)(gen);
+        }
+
+        const auto& road = roads_[index];
+        const auto start = road.GetStart();
+        const auto end = road.GetEnd();
+        if (road.IsHorizontal()) {
+            return { std::min(start.x, end.x) + offset, static_cast<double>(start.y) };
+        }
+        return { static_cast<double>(start.x), std::min(start.y, end.y) + offset };
+    }
+
     void Game::AddMap(Map map) {
-        const size_t index = maps_.size();
-        if (auto [it, inserted] = map_id_to_index_.emplace(map.GetId(), index); !inserted) {
+        if (maps_.size() > std::numeric_limits<MapIndex>::max()) {
+            throw std::invalid_argument("Too many maps");
+        }
+        const auto index = static_cast<MapIndex>(maps_.size());
+        if (auto [it, inserted] = map_id_to_index_.emplace(*map.GetId(), index); !inserted) {
             throw std::invalid_argument("Map with id "s + *map.GetId() + " already exists"s);
         }
         else {
             try {
+                map_players_.emplace_back();
                 maps_.emplace_back(std::move(map));
             }
             catch (...) {
+                map_players_.resize(index);
                 map_id_to_index_.erase(it);
                 throw;
             }
         }
     }
 
+    void Game::ReserveMaps(size_t maps) {
+        maps_.reserve(maps);
+        map_id_to_index_.reserve(maps);
+    }
+
+    Dog& Game::AddDog(Dog dog, Position position) {
+        if (dog.GetMapIndex() >= maps_.size()) {
+            throw std::invalid_argument("Map with index "s + std::to_string(dog.GetMapIndex()) + " not found"s);
+        }
+        if (dog_id_to_handle_.contains(dog.GetId())) {
+            throw std::invalid_argument("Duplicate dog");
+        }
+
+        const size_t slot = dog_motion_->Add(position.x, position.y, dog.GetMapIndex());
+        dog.BindMotion(dog_motion_.get(), slot);
+
+        const auto dog_id = dog.GetId();
+        DogHandle handle;
+        try {
+            handle = dogs_.Insert(std::move(dog));
+        }
+        catch (...) {
+            dog_motion_->SwapRemove(slot);
+            throw;
+        }
+
+        try {
+            dog_id_to_handle_.emplace(dog_id, handle);
+        }
+        catch (...) {
+            dogs_.Erase(handle);
+            dog_motion_->SwapRemove(slot);
+            throw;
+        }
+        return *dogs_.Find(handle);
+    }
+
+    void Game::RemoveDog(const Dog::Id& id) {
+        auto it = dog_id_to_handle_.find(id);
+        if (it == dog_id_to_handle_.end()) {
+            return;
+        }
+
+        const auto handle = it->second;
+        dog_id_to_handle_.erase(it);
+
+        auto dense = dogs_.DenseIndex(handle);
+        if (!dense) {
+            return;
+        }
+
+        // Dogs and their motion slots are removed the same way, so dense indices stay aligned.
+        dogs_.Erase(handle);
+        dog_motion_->SwapRemove(*dense);
+        if (*dense < dogs_.Size()) {
+            dogs_[*dense].BindMotion(dog_motion_.get(), *dense);
+        }
+    }
+
+    void Game::Reserve(size_t players) {
+        dogs_.Reserve(players);
+        players_.Reserve(players);
+        map_player_positions_.reserve(players);
+        dog_motion_->Reserve(players);
+        dog_id_to_handle_.reserve(players);
+        player_id_to_handle_.reserve(players);
+    }
+
+    Player& Game::AddPlayer(Player player) {
+        if (player.GetMapIndex() >= maps_.size()) {
+            throw std::invalid_argument("Map with index "s + std::to_string(player.GetMapIndex()) + " not found"s);
+        }
+        if (player_id_to_handle_.contains(player.GetId())) {
+            throw std::invalid_argument("Duplicate player");
+        }
+        const auto token = Token::Parse(player.GetToken());
+        if (!token || token->Empty()) {
+            throw std::invalid_argument("Invalid token");
+        }
+        if (token_to_player_.Contains(*token)) {
+            throw std::invalid_argument("Duplicate token");
+        }
+
+        const auto player_id = player.GetId();
+        const auto map_index = player.GetMapIndex();
+        auto& map_players = map_players_[map_index];
+        const auto handle = players_.Insert(std::move(player));
+        try {
+            if (handle.index >= map_player_positions_.size()) {
+                map_player_positions_.resize(handle.index + 1);
+            }
+            map_player_positions_[handle.index] = static_cast<uint32_t>(map_players.size());
+            map_players.push_back(handle);
+            player_id_to_handle_.emplace(player_id, handle);
+            token_to_player_.Insert(*token, PlayerRef{ handle, map_index });
+        }
+        catch (...) {
+            if (!map_players.empty() && map_players.back() == handle) {
+                map_players.pop_back();
+            }
+            player_id_to_handle_.erase(player_id);
+            players_.Erase(handle);
+            throw;
+        }
+        return *players_.Find(handle);
+    }
+
+    void Game::RemovePlayer(const Player::Id& id) {
+        auto it = player_id_to_handle_.find(id);
+        if (it == player_id_to_handle_.end()) {
+            return;
+        }
+
+        const auto handle = it->second;
+        player_id_to_handle_.erase(it);
+
+        if (const auto* player = players_.Find(handle)) {
+            if (auto token = Token::Parse(player->GetToken())) {
+                token_to_player_.Erase(*token);
+            }
+
+            auto& map_players = map_players_[player->GetMapIndex()];
+            const uint32_t position = map_player_positions_[handle.index];
+            map_players[position] = map_players.back();
+            map_player_positions_[map_players[position].index] = position;
+            map_players.pop_back();
+        }
+        players_.Erase(handle);
+    }
+
 }  // namespace model
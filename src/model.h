@@ -1,20 +1,31 @@
 
 #pragma once
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
-#include <random>
-#include <sstream>
-#include <iomanip>
 #include <optional>
+#include <memory>
+#include <cstdlib>
 
 #include "tagged.h"
+#include "slot_map.h"
+#include "spatial_index.h"
+#include "dog_motion.h"
+#include "token_index.h"
+#include "random.h"
 
 namespace model {
 
     using Dimension = int;
     using Coord = Dimension;
 
+    // Position of a map in Game::GetMaps(), assigned at load time. Everything past
+    // the JSON boundary refers to maps by this index rather than by Map::Id.
+    using MapIndex = uint16_t;
+
     struct Point {
         Coord x, y;
     };
@@ -162,13 +173,27 @@ namespace model {
         Offset offset_;
     };
 
+    // A type's index in Map::GetLootTypes() is the type of items spawned from it.
+    struct LootType {
+        double value;
+    };
+
+    // Average time between spawns and the chance that a spawn happens per period.
+    struct LootGeneratorConfig {
+        double period_seconds;
+        double probability;
+    };
+
     class Map {
     public:
+        constexpr static double ROAD_HALF_WIDTH = 0.4;
+
         using Id = util::Tagged<std::string, Map>;
         using Roads = std::vector<Road>;
         using Buildings = std::vector<Building>;
         using Offices = std::vector<Office>;
         using LootItems = std::vector<LootItem>;
+        using LootTypes = std::vector<LootType>;
 
         Map(Id id, std::string name) noexcept
             : id_(std::move(id))
@@ -221,60 +246,83 @@ namespace model {
             default_bag_capacity_ = capacity;
         }
 
+        // Presizes the layout containers before a bulk load.
+        void Reserve(size_t roads, size_t buildings, size_t offices) {
+            roads_.reserve(roads);
+            road_length_prefix_.reserve(roads);
+            buildings_.reserve(buildings);
+            offices_.reserve(offices);
+            office_id_to_index_.reserve(offices);
+        }
+
         void AddRoad(const Road& road) {
+            const auto start = road.GetStart();
+            const auto end = road.GetEnd();
+            const double length = std::abs(end.x - start.x) + std::abs(end.y - start.y);
+            road_length_prefix_.push_back(GetTotalRoadLength() + length);
             roads_.emplace_back(road);
         }
 
+        double GetTotalRoadLength() const noexcept {
+            return road_length_prefix_.empty() ? 0.0 : road_length_prefix_.back();
+        }
+
+        const LootTypes& GetLootTypes() const noexcept {
+            return loot_types_;
+        }
+
+        void AddLootType(LootType type) {
+            loot_types_.push_back(type);
+        }
+
+        // nullopt means the game-wide default applies.
+        const std::optional<LootGeneratorConfig>& GetLootGeneratorConfig() const noexcept {
+            return loot_generator_config_;
+        }
+
+        void SetLootGeneratorConfig(LootGeneratorConfig config) {
+            loot_generator_config_ = config;
+        }
+
         void AddBuilding(const Building& building) {
             buildings_.emplace_back(building);
         }
 
         void AddOffice(Office office);
 
-        void AddLootItem(LootItem item) {
-            loot_items_.push_back(std::move(item));
-        }
+        void AddLootItem(LootItem item);
+        void RemoveLootItem(const LootItem::Id& id);
 
-        void RemoveLootItem(const LootItem::Id& id) {
-            loot_items_.erase(
-                std::remove_if(loot_items_.begin(), loot_items_.end(),
-                    [&id](const LootItem& item) { return item.GetId() == id; }),
-                loot_items_.end());
+        LootItem* FindLootItem(const LootItem::Id& id) {
+            auto it = loot_id_to_index_.find(id);
+            return it != loot_id_to_index_.end() ? &loot_items_[it->second] : nullptr;
         }
 
-        LootItem* FindLootItem(const LootItem::Id& id) {
-            auto it = std::find_if(loot_items_.begin(), loot_items_.end(),
-                [&id](const LootItem& item) { return item.GetId() == id; });
-            return it != loot_items_.end() ? &(*it) : nullptr;
+        const LootItem* FindLootItem(const LootItem::Id& id) const {
+            auto it = loot_id_to_index_.find(id);
+            return it != loot_id_to_index_.end() ? &loot_items_[it->second] : nullptr;
         }
 
-        Position GetRandomDogPosition() const {
-            if (roads_.empty()) {
-                return { 0.0, 0.0 };
-            }
+        template <typename Fn>
+        void ForEachLootCandidate(Position start, Position end, double radius, Fn&& fn) const {
+            loot_index_.ForEachCandidate(start.x, start.y, end.x, end.y, radius,
+                [this, &fn](const LootIndex::Entry& entry) {
+                    if (const auto* item = FindLootItem(entry.key)) {
+                        fn(*item);
+                    }
+                });
+        }
 
-            std::random_device rd;
-            std::mt19937 gen(rd());
-            std::uniform_int_distribution<size_t> road_dist(0, roads_.size() - 1);
-
-            const auto& road = roads_[road_dist(gen)];
-            auto start = road.GetStart();
-            if (road.IsHorizontal()) {
-                std::uniform_real_distribution<double> pos_dist(
-                    std::min(start.x, road.GetEnd().x),
-                    std::max(start.x, road.GetEnd().x)
-                );
-                return { pos_dist(gen), static_cast<double>(start.y) };
-            }
-            else {
-                std::uniform_real_distribution<double> pos_dist(
-                    std::min(start.y, road.GetEnd().y),
-                    std::max(start.y, road.GetEnd().y)
-                );
-                return { static_cast<double>(start.x), pos_dist(gen) };
-            }
+        template <typename Fn>
+        void ForEachOfficeCandidate(Position start, Position end, double radius, Fn&& fn) const {
+            office_index_.ForEachCandidate(start.x, start.y, end.x, end.y, radius,
+                [this, &fn](const OfficeIndex::Entry& entry) { fn(offices_[entry.key]); });
         }
 
+        // Uniform over the total length of the roads: a binary search over the
+        // length prefix sums picks the road, the remainder is the offset along it.
+        Position GetRandomRoadPosition(util::Xoshiro256& gen) const;
+
         Position GetDefaultDogPosition() const {
             if (roads_.empty()) {
                 return { 0.0, 0.0 };
@@ -287,6 +335,9 @@ namespace model {
 
     private:
         using OfficeIdToIndex = std::unordered_map<Office::Id, size_t, util::TaggedHasher<Office::Id>>;
+        using LootIdToIndex = std::unordered_map<LootItem::Id, size_t, util::TaggedHasher<LootItem::Id>>;
+        using LootIndex = SpatialIndex<LootItem::Id>;
+        using OfficeIndex = SpatialIndex<size_t>;
 
         Id id_;
         std::string name_;
@@ -295,6 +346,12 @@ namespace model {
         Offices offices_;
         LootItems loot_items_;
         OfficeIdToIndex office_id_to_index_;
+        LootIdToIndex loot_id_to_index_;
+        std::vector<double> road_length_prefix_;
+        LootTypes loot_types_;
+        std::optional<LootGeneratorConfig> loot_generator_config_;
+        LootIndex loot_index_;
+        OfficeIndex office_index_;
         double dog_speed_;
         std::optional<int> bag_capacity_;
         int default_bag_capacity_;
@@ -304,12 +361,10 @@ namespace model {
     public:
         using Id = util::Tagged<uint32_t, Dog>;
 
-        Dog(Id id, std::string name, Map::Id map_id, Position position)
+        Dog(Id id, std::string name, MapIndex map_index)
             : id_(std::move(id))
             , name_(std::move(name))
-            , map_id_(std::move(map_id))
-            , position_(position)
-            , velocity_{ 0.0, 0.0 }
+            , map_index_(map_index)
             , direction_(Direction::North)
             , bag_capacity_(3)
             , score_(0) {
@@ -317,9 +372,10 @@ namespace model {
 
         const Id& GetId() const noexcept { return id_; }
         const std::string& GetName() const noexcept { return name_; }
-        const Map::Id& GetMapId() const noexcept { return map_id_; }
-        Position GetPosition() const noexcept { return position_; }
-        Velocity GetVelocity() const noexcept { return velocity_; }
+        MapIndex GetMapIndex() const noexcept { return map_index_; }
+        Position GetPosition() const noexcept { return { motion_->x[slot_], motion_->y[slot_] }; }
+        Velocity GetVelocity() const noexcept { return { motion_->vx[slot_], motion_->vy[slot_] }; }
+        size_t GetMotionSlot() const noexcept { return slot_; }
         Direction GetDirection() const noexcept { return direction_; }
         
         const std::vector<BagItem>& GetBag() const noexcept { return bag_; }
@@ -327,8 +383,8 @@ namespace model {
         int GetScore() const noexcept { return score_; }
         bool IsBagFull() const noexcept { return bag_.size() >= static_cast<size_t>(bag_capacity_); }
 
-        void SetPosition(Position position) { position_ = position; }
-        void SetVelocity(Velocity velocity) { velocity_ = velocity; }
+        void SetPosition(Position position) { motion_->SetPosition(slot_, position.x, position.y); }
+        void SetVelocity(Velocity velocity) { motion_->SetVelocity(slot_, velocity.vx, velocity.vy); }
         void SetDirection(Direction direction) { direction_ = direction; }
         void SetBagCapacity(int capacity) { bag_capacity_ = capacity; }
 
@@ -347,11 +403,18 @@ namespace model {
         }
 
     private:
+        friend class Game;
+
+        void BindMotion(DogMotion* motion, size_t slot) noexcept {
+            motion_ = motion;
+            slot_ = slot;
+        }
+
         Id id_;
         std::string name_;
-        Map::Id map_id_;
-        Position position_;
-        Velocity velocity_;
+        MapIndex map_index_;
+        DogMotion* motion_ = nullptr;
+        size_t slot_ = 0;
         Direction direction_;
         std::vector<BagItem> bag_;
         int bag_capacity_;
@@ -362,88 +425,139 @@ namespace model {
     public:
         using Id = util::Tagged<uint32_t, Player>;
 
-        Player(Id id, std::string name, Dog::Id dog_id, Map::Id map_id, std::string token)
+        Player(Id id, std::string name, Dog::Id dog_id, MapIndex map_index, std::string token)
             : id_(std::move(id))
             , name_(std::move(name))
             , dog_id_(std::move(dog_id))
-            , map_id_(std::move(map_id))
+            , map_index_(map_index)
             , token_(std::move(token)) {
         }
 
         const Id& GetId() const noexcept { return id_; }
         const std::string& GetName() const noexcept { return name_; }
         const Dog::Id& GetDogId() const noexcept { return dog_id_; }
-        const Map::Id& GetMapId() const noexcept { return map_id_; }
+        MapIndex GetMapIndex() const noexcept { return map_index_; }
         const std::string& GetToken() const noexcept { return token_; }
 
     private:
         Id id_;
         std::string name_;
         Dog::Id dog_id_;
-        Map::Id map_id_;
+        MapIndex map_index_;
         std::string token_;
     };
 
-    class TokenGenerator {
-    public:
-        std::string GenerateToken() {
-            std::uniform_int_distribution<uint64_t> dist;
-            uint64_t part1 = dist(generator1_);
-            uint64_t part2 = dist(generator2_);
-
-            std::stringstream ss;
-            ss << std::hex << std::setfill('0')
-                << std::setw(16) << part1
-                << std::setw(16) << part2;
-            return ss.str();
-        }
-
-    private:
-        std::random_device random_device_;
-        std::mt19937_64 generator1_{ [this] {
-            std::uniform_int_distribution<std::mt19937_64::result_type> dist;
-            return dist(random_device_);
-        }() };
-        std::mt19937_64 generator2_{ [this] {
-            std::uniform_int_distribution<std::mt19937_64::result_type> dist;
-            return dist(random_device_);
-        }() };
-    };
-
     class Game {
     public:
         using Maps = std::vector<Map>;
+        using Dogs = util::SlotMap<Dog>;
+        using Players = util::SlotMap<Player>;
+        using DogHandle = Dogs::Handle;
+        using PlayerHandle = Players::Handle;
+
+        // What the token index knows about a player: enough to route a request to
+        // its map without touching the player table, which only the game thread may read.
+        struct PlayerRef {
+            PlayerHandle handle;
+            MapIndex map_index;
+            uint16_t reserved = 0;
+        };
 
-        Game() : default_dog_speed_(1.0), default_bag_capacity_(3) {}
+        Game() : default_dog_speed_(1.0), default_bag_capacity_(3), default_loot_generator_config_{ 5.0, 0.5 } {}
 
         void AddMap(Map map);
+        void ReserveMaps(size_t maps);
 
         const Maps& GetMaps() const noexcept {
             return maps_;
         }
 
-        const Map* FindMap(const Map::Id& id) const noexcept {
+        const Map& GetMap(MapIndex index) const noexcept {
+            return maps_[index];
+        }
+
+        // Loot changes during the tick; the roads, buildings and offices of a map never do.
+        Map& GetMap(MapIndex index) noexcept {
+            return maps_[index];
+        }
+
+        // The string lookups are for the JSON boundary only.
+        std::optional<MapIndex> FindMapIndex(std::string_view id) const noexcept {
             if (auto it = map_id_to_index_.find(id); it != map_id_to_index_.end()) {
-                return &maps_.at(it->second);
+                return it->second;
             }
-            return nullptr;
+            return std::nullopt;
         }
 
-        std::vector<Dog>& GetDogs() { return dogs_; }
-        std::vector<Player>& GetPlayers() { return players_; }
+        const Map* FindMap(const Map::Id& id) const noexcept {
+            auto index = FindMapIndex(*id);
+            return index ? &maps_[*index] : nullptr;
+        }
+
+        Dogs& GetDogs() noexcept { return dogs_; }
+        const Dogs& GetDogs() const noexcept { return dogs_; }
+        Players& GetPlayers() noexcept { return players_; }
+        const Players& GetPlayers() const noexcept { return players_; }
+        DogMotion& GetDogMotion() noexcept { return *dog_motion_; }
+        const DogMotion& GetDogMotion() const noexcept { return *dog_motion_; }
+
+        Dog& AddDog(Dog dog, Position position);
+        void RemoveDog(const Dog::Id& id);
 
-        std::unordered_map<std::string, size_t>& GetTokenToPlayerIndex() { return token_to_player_index_; }
-        std::unordered_map<Player::Id, size_t, util::TaggedHasher<Player::Id>>& GetPlayerIdToIndex() { return player_id_to_index_; }
-        std::unordered_map<Dog::Id, size_t, util::TaggedHasher<Dog::Id>>& GetDogIdToIndex() { return dog_id_to_index_; }
+        Player& AddPlayer(Player player);
+        void RemovePlayer(const Player::Id& id);
+
+        // Players on one map in no particular order, kept up to date by AddPlayer
+        // and RemovePlayer, so per-map queries never scan the other maps.
+        const std::vector<PlayerHandle>& GetMapPlayers(MapIndex index) const noexcept {
+            return map_players_[index];
+        }
+
+        // Sizes the dog and player tables for bulk loads such as a state restore.
+        void Reserve(size_t players);
 
         Dog* FindDog(const Dog::Id& id) {
-            auto it = dog_id_to_index_.find(id);
-            return it != dog_id_to_index_.end() ? &dogs_.at(it->second) : nullptr;
+            auto it = dog_id_to_handle_.find(id);
+            return it != dog_id_to_handle_.end() ? dogs_.Find(it->second) : nullptr;
+        }
+
+        const Dog* FindDog(const Dog::Id& id) const {
+            auto it = dog_id_to_handle_.find(id);
+            return it != dog_id_to_handle_.end() ? dogs_.Find(it->second) : nullptr;
         }
 
         Player* FindPlayer(const Player::Id& id) {
-            auto it = player_id_to_index_.find(id);
-            return it != player_id_to_index_.end() ? &players_.at(it->second) : nullptr;
+            auto it = player_id_to_handle_.find(id);
+            return it != player_id_to_handle_.end() ? players_.Find(it->second) : nullptr;
+        }
+
+        std::optional<PlayerHandle> FindPlayerHandle(const Player::Id& id) const {
+            auto it = player_id_to_handle_.find(id);
+            return it != player_id_to_handle_.end() ? std::optional{ it->second } : std::nullopt;
+        }
+
+        Player* FindPlayer(PlayerHandle handle) noexcept {
+            return players_.Find(handle);
+        }
+
+        const Player* FindPlayer(PlayerHandle handle) const noexcept {
+            return players_.Find(handle);
+        }
+
+        // Both are safe to call concurrently with AddPlayer and RemovePlayer.
+        std::optional<PlayerRef> FindPlayerRefByToken(std::string_view token) const noexcept {
+            auto parsed = Token::Parse(token);
+            return parsed ? token_to_player_.Find(*parsed) : std::nullopt;
+        }
+
+        std::optional<PlayerHandle> FindPlayerHandleByToken(std::string_view token) const noexcept {
+            auto ref = FindPlayerRefByToken(token);
+            return ref ? std::optional{ ref->handle } : std::nullopt;
+        }
+
+        Player* FindPlayerByToken(std::string_view token) noexcept {
+            auto handle = FindPlayerHandleByToken(token);
+            return handle ? players_.Find(*handle) : nullptr;
         }
 
         double GetDefaultDogSpeed() const noexcept { return default_dog_speed_; }
@@ -452,25 +566,39 @@ namespace model {
         int GetDefaultBagCapacity() const noexcept { return default_bag_capacity_; }
         void SetDefaultBagCapacity(int capacity) { default_bag_capacity_ = capacity; }
 
+        const LootGeneratorConfig& GetDefaultLootGeneratorConfig() const noexcept { return default_loot_generator_config_; }
+        void SetDefaultLootGeneratorConfig(LootGeneratorConfig config) { default_loot_generator_config_ = config; }
+
     private:
-        using MapIdHasher = util::TaggedHasher<Map::Id>;
-        using MapIdToIndex = std::unordered_map<Map::Id, size_t, MapIdHasher>;
+        struct MapIdHasher {
+            using is_transparent = void;
+
+            size_t operator()(std::string_view id) const noexcept {
+                return std::hash<std::string_view>{}(id);
+            }
+        };
+
+        using MapIdToIndex = std::unordered_map<std::string, MapIndex, MapIdHasher, std::equal_to<>>;
 
         std::vector<Map> maps_;
         MapIdToIndex map_id_to_index_;
 
-        std::vector<Dog> dogs_;
-        std::vector<Player> players_;
+        Dogs dogs_;
+        std::unique_ptr<DogMotion> dog_motion_ = std::make_unique<DogMotion>();
+        Players players_;
+        std::vector<std::vector<PlayerHandle>> map_players_;
+        // Position of each player in its map_players_ list, indexed by handle slot.
+        std::vector<uint32_t> map_player_positions_;
         double default_dog_speed_;
         int default_bag_capacity_;
+        LootGeneratorConfig default_loot_generator_config_;
 
-        using TokenToPlayerIndex = std::unordered_map<std::string, size_t>;
-        using PlayerIdToIndex = std::unordered_map<Player::Id, size_t, util::TaggedHasher<Player::Id>>;
-        using DogIdToIndex = std::unordered_map<Dog::Id, size_t, util::TaggedHasher<Dog::Id>>;
+        using PlayerIdToHandle = std::unordered_map<Player::Id, PlayerHandle, util::TaggedHasher<Player::Id>>;
+        using DogIdToHandle = std::unordered_map<Dog::Id, DogHandle, util::TaggedHasher<Dog::Id>>;
 
-        TokenToPlayerIndex token_to_player_index_;
-        PlayerIdToIndex player_id_to_index_;
-        DogIdToIndex dog_id_to_index_;
+        TokenIndex<PlayerRef> token_to_player_;
+        PlayerIdToHandle player_id_to_handle_;
+        DogIdToHandle dog_id_to_handle_;
     };
 
 }  // namespace model
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace util {
+
+// Unbounded multi-producer single-consumer queue (Vyukov's intrusive list with a
+// stub node). Push is one atomic exchange and never blocks; Drain must only be
+// called from one thread at a time. An item whose Push is still in progress when
+// Drain runs is picked up by the next Drain.
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue()
+        : head_(new Node)
+        , tail_(head_.load(std::memory_order_relaxed)) {
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    ~MpscQueue() {
+        Drain([](T&&) {});
+        delete tail_;
+    }
+
+    void Push(T value) {
+        auto* node = new Node;
+        node->value.emplace(std::move(value));
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // Publishes [first, last) with a single exchange; the items stay contiguous and
+    // in order in the queue.
+    template <typename It>
+    void PushAll(It first, It last) {
+        Node* chain_head = nullptr;
+        Node* chain_tail = nullptr;
+        try {
+            for (; first != last; ++first) {
+                auto node = std::make_unique<Node>();
+                node->value.emplace(std::move(*first));
+                Node* linked = node.release();
+                if (chain_tail) {
+                    chain_tail->next.store(linked, std::memory_order_relaxed);
+                } else {
+                    chain_head = linked;
+                }
+                chain_tail = linked;
+            }
+        } catch (...) {
+            while (chain_head) {
+                delete std::exchange(chain_head, chain_head->next.load(std::memory_order_relaxed));
+            }
+            throw;
+        }
+        if (!chain_head) {
+            return;
+        }
+        Node* prev = head_.exchange(chain_tail, std::memory_order_acq_rel);
+        prev->next.store(chain_head, std::memory_order_release);
+    }
+
+    // Passes every published item to fn in push order; returns how many there were.
+    template <typename Fn>
+    size_t Drain(Fn&& fn) {
+        size_t count = 0;
+        while (Node* next = tail_->next.load(std::memory_order_acquire)) {
+            fn(std::move(*next->value));
+            next->value.reset();
+            delete tail_;
+            tail_ = next;
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    struct Node {
+        std::optional<T> value;
+        std::atomic<Node*> next{ nullptr };
+    };
+
+    std::atomic<Node*> head_;
+    Node* tail_;
+};
+
+}  // namespace util
@@ -1,7 +1,10 @@
 
 #include "request_handler.h"
+#include "binary_state.h"
 #include <boost/beast/http.hpp>
 #include <boost/json.hpp>
+#include <boost/system/system_error.hpp>
+#include <exception>
 #include <functional>
 #include <fstream>
 #include <sstream>
@@ -22,7 +25,9 @@ namespace http_handler {
         http::response<http::string_body> MakeErrorResponse(const Request& req, http::status status,
             std::string code,
             std::string message) {
-            json::object error_json;
+            unsigned char buffer[512];
+            json::monotonic_resource arena{ buffer };
+            json::object error_json(&arena);
             error_json["code"] = code;
             error_json["message"] = message;
 
@@ -35,24 +40,108 @@ namespace http_handler {
             return response;
         }
 
-        std::string ExtractMapId(std::string_view path) {
-            const std::string prefix = "/api/v1/maps/";
-            if (path.size() <= prefix.size()) {
-                return "";
+        template <typename Request>
+        std::optional<std::string> ExtractBearerToken(const Request& req) {
+            constexpr std::string_view prefix = "Bearer ";
+            auto it = req.find(http::field::authorization);
+            if (it == req.end()) {
+                return std::nullopt;
+            }
+
+            std::string_view value{ it->value().data(), it->value().size() };
+            if (!value.starts_with(prefix)) {
+                return std::nullopt;
+            }
+            value.remove_prefix(prefix.size());
+            if (value.size() != 32 || value.find_first_not_of("0123456789abcdefABCDEF") != std::string_view::npos) {
+                return std::nullopt;
+            }
+            return std::string(value);
+        }
+
+        std::optional<app::PlayerMove> ParseMoveRequest(std::string_view body) {
+            boost::system::error_code ec;
+            auto value = json::parse(body, ec);
+            if (ec || !value.is_object()) {
+                return std::nullopt;
+            }
+            const auto* move = value.as_object().if_contains("move");
+            if (!move || !move->is_string()) {
+                return std::nullopt;
             }
+            return app::ParsePlayerMove(move->as_string());
+        }
+
+        constexpr size_t MAX_BATCH_ACTIONS = 10000;
 
-            std::string map_id = std::string(path.substr(prefix.size()));
-            size_t pos = map_id.find('/');
-            if (pos != std::string::npos) {
-                map_id = map_id.substr(0, pos);
+        // {"actions": [{"authToken": "...", "move": "L"}, ...]}. The views point into
+        // value, which must outlive them.
+        std::optional<std::vector<app::TokenAction>> ParseBatchActionRequest(const json::value& value) {
+            const auto* object = value.if_object();
+            const auto* actions = object ? object->if_contains("actions") : nullptr;
+            if (!actions || !actions->is_array() || actions->as_array().size() > MAX_BATCH_ACTIONS) {
+                return std::nullopt;
             }
 
-            pos = map_id.find('?');
-            if (pos != std::string::npos) {
-                map_id = map_id.substr(0, pos);
+            std::vector<app::TokenAction> parsed;
+            parsed.reserve(actions->as_array().size());
+            for (const auto& action : actions->as_array()) {
+                const auto* entry = action.if_object();
+                const auto* token = entry ? entry->if_contains("authToken") : nullptr;
+                const auto* move = entry ? entry->if_contains("move") : nullptr;
+                if (!token || !token->is_string() || !move || !move->is_string()) {
+                    return std::nullopt;
+                }
+                auto parsed_move = app::ParsePlayerMove(move->as_string());
+                if (!parsed_move) {
+                    return std::nullopt;
+                }
+                parsed.push_back({ token->as_string(), *parsed_move });
             }
+            return parsed;
+        }
 
-            return map_id;
+        template <typename Request>
+        bool AcceptsBinaryState(const Request& req) {
+            auto it = req.find(http::field::accept);
+            return it != req.end()
+                && std::string_view{ it->value().data(), it->value().size() }.find(app::binary::MEDIA_TYPE) != std::string_view::npos;
+        }
+
+        // body points into the published snapshot and keeps it alive while it is written.
+        template <typename Request>
+        http_server::SharedResponse MakeSnapshotResponse(const Request& req, std::shared_ptr<const std::string> body,
+            bool binary) {
+            http_server::SharedResponse shared{ { http::status::ok, req.version() }, nullptr };
+            auto& response = shared.response;
+            if (binary) {
+                response.set(http::field::content_type,
+                    std::string(app::binary::MEDIA_TYPE) + "; version=" + std::to_string(app::binary::FORMAT_VERSION));
+            }
+            else {
+                response.set(http::field::content_type, "application/json");
+            }
+            response.set(http::field::cache_control, "no-cache");
+            response.set(http::field::vary, "Accept");
+            if (req.method() == http::verb::head) {
+                response.content_length(body->size());
+            }
+            else {
+                response.body() = { body->data(), body->size() };
+                response.prepare_payload();
+                shared.body = std::move(body);
+            }
+            return shared;
+        }
+
+        std::string_view ExtractMapId(std::string_view path) {
+            constexpr std::string_view prefix = "/api/v1/maps/";
+            if (path.size() <= prefix.size()) {
+                return {};
+            }
+
+            std::string_view map_id = path.substr(prefix.size());
+            return map_id.substr(0, map_id.find_first_of("/?"));
         }
 
         json::object SerializeRoad(const model::Road& road) {
@@ -163,6 +252,141 @@ namespace http_handler {
             return map_json;
         }
 
+        std::string MakeETag(std::string_view body) {
+            std::ostringstream etag;
+            etag << '"' << std::hex << std::hash<std::string_view>{}(body)
+                << '-' << body.size() << '"';
+            return etag.str();
+        }
+
+        bool ETagMatches(std::string_view if_none_match, std::string_view etag) {
+            return if_none_match == "*" || if_none_match.find(etag) != std::string_view::npos;
+        }
+
+        std::string_view ToStringView(beast::string_view value) {
+            return { value.data(), value.size() };
+        }
+
+        struct ByteRange {
+            std::uint64_t first;
+            std::uint64_t last;
+        };
+
+        // Parses a single "bytes=first-last" range. Multi-range requests yield
+        // nullopt and are served in full; unsatisfiable ones yield an empty range.
+        std::optional<std::optional<ByteRange>> ParseByteRange(std::string_view header, std::uint64_t size) {
+            constexpr std::string_view prefix = "bytes=";
+            if (!header.starts_with(prefix) || header.find(',') != std::string_view::npos) {
+                return std::nullopt;
+            }
+            header.remove_prefix(prefix.size());
+
+            const size_t dash = header.find('-');
+            if (dash == std::string_view::npos) {
+                return std::nullopt;
+            }
+
+            auto parse = [](std::string_view digits) -> std::optional<std::uint64_t> {
+                if (digits.empty() || digits.size() > 19) {
+                    return std::nullopt;
+                }
+                std::uint64_t value = 0;
+                for (char c : digits) {
+                    if (c < '0' || c > '9') {
+                        return std::nullopt;
+                    }
+                    value = value * 10 + static_cast<std::uint64_t>(c - '0');
+                }
+                return value;
+            };
+
+            const auto first_str = header.substr(0, dash);
+            const auto last_str = header.substr(dash + 1);
+            if (first_str.empty()) {
+                auto suffix = parse(last_str);
+                if (!suffix) {
+                    return std::nullopt;
+                }
+                if (*suffix == 0 || size == 0) {
+                    return std::optional<ByteRange>{};
+                }
+                const std::uint64_t length = std::min(*suffix, size);
+                return std::optional<ByteRange>{ ByteRange{ size - length, size - 1 } };
+            }
+
+            auto first = parse(first_str);
+            if (!first) {
+                return std::nullopt;
+            }
+            std::uint64_t last = size == 0 ? 0 : size - 1;
+            if (!last_str.empty()) {
+                auto parsed_last = parse(last_str);
+                if (!parsed_last || *parsed_last < *first) {
+                    return std::nullopt;
+                }
+                last = std::min(last, *parsed_last);
+            }
+            if (*first >= size) {
+                return std::optional<ByteRange>{};
+            }
+            return std::optional<ByteRange>{ ByteRange{ *first, last } };
+        }
+
+        template <typename Request>
+        bool IsNotModified(const Request& req, std::string_view etag,
+            std::chrono::system_clock::time_point modified_at) {
+            if (auto it = req.find(http::field::if_none_match); it != req.end()) {
+                return ETagMatches(ToStringView(it->value()), etag);
+            }
+            if (auto it = req.find(http::field::if_modified_since); it != req.end()) {
+                auto since = ParseHttpDate(ToStringView(it->value()));
+                return since && std::chrono::floor<std::chrono::seconds>(modified_at) <= *since;
+            }
+            return false;
+        }
+
+    }
+
+    void RequestHandler::BuildMapCache() {
+        json::array maps_json;
+
+        for (const auto& map : application_.GetGame().GetMaps()) {
+            json::object map_info;
+            map_info["id"] = *map.GetId();
+            map_info["name"] = map.GetName();
+            maps_json.push_back(std::move(map_info));
+
+            std::string body = json::serialize(SerializeMap(map));
+            std::string etag = MakeETag(body);
+            map_cache_.emplace(*map.GetId(), std::make_shared<const CachedJson>(CachedJson{ std::move(body), std::move(etag) }));
+        }
+
+        std::string body = json::serialize(maps_json);
+        std::string etag = MakeETag(body);
+        maps_list_cache_ = std::make_shared<const CachedJson>(CachedJson{ std::move(body), std::move(etag) });
+    }
+
+    template <typename Body, typename Allocator, typename Send>
+    void RequestHandler::SendCachedJson(const http::request<Body, http::basic_fields<Allocator>>& req, Send&& send,
+        const std::shared_ptr<const CachedJson>& cached) {
+        if (auto it = req.find(http::field::if_none_match);
+            it != req.end() && ETagMatches({ it->value().data(), it->value().size() }, cached->etag)) {
+            http::response<http::string_body> response{ http::status::not_modified, req.version() };
+            response.set(http::field::etag, cached->etag);
+            response.set(http::field::cache_control, "no-cache");
+            send(std::move(response));
+            return;
+        }
+
+        // The response holds a reference to the cache entry instead of a copy of it.
+        http_server::SharedResponse response{ { http::status::ok, req.version() }, { cached, &cached->body } };
+        response.response.set(http::field::content_type, "application/json");
+        response.response.set(http::field::cache_control, "no-cache");
+        response.response.set(http::field::etag, cached->etag);
+        response.response.body() = { response.body->data(), response.body->size() };
+        response.response.prepare_payload();
+
+        send(std::move(response));
     }
 
     template <typename Body, typename Allocator, typename Send>
@@ -177,85 +401,221 @@ namespace http_handler {
 
     template <typename Body, typename Allocator, typename Send>
     void RequestHandler::HandleFileRequest(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
-        SendErrorResponse(req, std::forward<Send>(send),
-            http::status::not_found, "notFound", "Not found");
+        if (req.method() != http::verb::get && req.method() != http::verb::head) {
+            SendErrorResponse(req, std::forward<Send>(send),
+                http::status::method_not_allowed,
+                "methodNotAllowed", "Only GET and HEAD methods are allowed");
+            return;
+        }
+
+        auto path = DecodeUrlPath(ToStringView(req.target()));
+        auto entry = path ? file_cache_.Lookup(*path) : nullptr;
+        if (!entry) {
+            SendErrorResponse(req, std::forward<Send>(send),
+                http::status::not_found, "notFound", "Not found");
+            return;
+        }
+
+        // Ranges are always served from the identity encoding.
+        const auto range_it = req.find(http::field::range);
+        const StaticFileCache::Variant* variant = nullptr;
+        if (range_it == req.end() && !entry->precompressed.empty()) {
+            if (auto it = req.find(http::field::accept_encoding); it != req.end()) {
+                const auto accepted = ToStringView(it->value());
+                for (const auto& candidate : entry->precompressed) {
+                    if (accepted.find(candidate.encoding) != std::string_view::npos) {
+                        variant = &candidate;
+                        break;
+                    }
+                }
+            }
+        }
+
+        const std::string& etag = variant ? variant->etag : entry->etag;
+        const auto& file_path = variant ? variant->path : entry->path;
+        const std::uint64_t size = variant ? variant->size : entry->size;
+
+        auto set_common_fields = [&](auto& response) {
+            response.set(http::field::etag, etag);
+            response.set(http::field::last_modified, entry->last_modified);
+            response.set(http::field::accept_ranges, "bytes");
+            if (!entry->precompressed.empty()) {
+                response.set(http::field::vary, "Accept-Encoding");
+            }
+            response.keep_alive(req.keep_alive());
+        };
+
+        if (IsNotModified(req, etag, entry->modified_at)) {
+            http::response<http::string_body> response{ http::status::not_modified, req.version() };
+            set_common_fields(response);
+            send(std::move(response));
+            return;
+        }
+
+        std::optional<ByteRange> range;
+        if (range_it != req.end()) {
+            bool range_applies = true;
+            if (auto if_range = req.find(http::field::if_range); if_range != req.end()) {
+                range_applies = ToStringView(if_range->value()) == etag;
+            }
+            if (range_applies) {
+                if (auto parsed = ParseByteRange(ToStringView(range_it->value()), size)) {
+                    if (!*parsed) {
+                        http::response<http::string_body> response{ http::status::range_not_satisfiable, req.version() };
+                        set_common_fields(response);
+                        response.set(http::field::content_range, "bytes */" + std::to_string(size));
+                        response.prepare_payload();
+                        send(std::move(response));
+                        return;
+                    }
+                    range = *parsed;
+                }
+            }
+        }
+
+        beast::error_code ec;
+        http_server::FileResponse response;
+        response.file.open(file_path.c_str(), beast::file_mode::scan, ec);
+        if (ec) {
+            SendErrorResponse(req, std::forward<Send>(send),
+                http::status::not_found, "notFound", "Not found");
+            return;
+        }
+
+        const std::uint64_t offset = range ? range->first : 0;
+        const std::uint64_t length = range ? range->last - range->first + 1 : size;
+
+        auto& header = response.header;
+        header.version(req.version());
+        header.result(range ? http::status::partial_content : http::status::ok);
+        header.set(http::field::content_type, entry->content_type);
+        if (variant) {
+            header.set(http::field::content_encoding, variant->encoding);
+        }
+        if (range) {
+            header.set(http::field::content_range, "bytes " + std::to_string(range->first) + "-"
+                + std::to_string(range->last) + "/" + std::to_string(size));
+        }
+        set_common_fields(header);
+        header.content_length(length);
+
+        response.offset = offset;
+        response.length = req.method() == http::verb::head ? 0 : length;
+        send(std::move(response));
     }
 
     template <typename Body, typename Allocator, typename Send>
     void RequestHandler::HandleApiRequest(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
         std::string_view target = req.target();
+        TimedSend<std::decay_t<Send>> timed_send{ std::forward<Send>(send), application_.GetMetrics(),
+            metrics::ClassifyRoute(target) };
         if (is_auto_tick_mode_ && target.starts_with("/api/v1/game/tick")) {
-            SendBadRequest(std::forward<Send>(send), "Invalid endpoint");
+            SendBadRequest(std::move(timed_send), "Invalid endpoint");
             return;
         }
 
         if (target.starts_with("/api/v1/game/join")) {
-            join_handler_.HandleRequest(std::move(req), std::forward<Send>(send));
+            RunOnGameStrand(std::move(req), std::move(timed_send), [this](auto&& req, auto&& send) {
+                join_handler_.HandleRequest(std::move(req), std::move(send));
+            });
         }
         else if (target.starts_with("/api/v1/game/players")) {
-            players_handler_.HandleRequest(std::move(req), std::forward<Send>(send));
+            HandleGetPlayers(std::forward<decltype(req)>(req), std::move(timed_send));
         }
         else if (target.starts_with("/api/v1/game/state")) {
-            game_state_handler_.HandleRequest(std::move(req), std::forward<Send>(send));
+            HandleGetGameState(std::forward<decltype(req)>(req), std::move(timed_send));
+        }
+        // Auto tick mode actions only go through the lock-free queue; manual ones
+        // change the game directly.
+        else if (target.starts_with("/api/v1/game/player/actions")) {
+            if (is_auto_tick_mode_) {
+                HandlePlayerActions(std::forward<decltype(req)>(req), std::move(timed_send));
+            }
+            else {
+                RunOnGameStrand(std::move(req), std::move(timed_send), [this](auto&& req, auto&& send) {
+                    HandlePlayerActions(std::move(req), std::move(send));
+                });
+            }
         }
         else if (target.starts_with("/api/v1/game/player/action")) {
-            player_action_handler_.HandleRequest(std::move(req), std::forward<Send>(send));
+            if (is_auto_tick_mode_) {
+                HandlePlayerAction(std::forward<decltype(req)>(req), std::move(timed_send));
+            }
+            else {
+                RunOnGameStrand(std::move(req), std::move(timed_send), [this](auto&& req, auto&& send) {
+                    HandlePlayerAction(std::move(req), std::move(send));
+                });
+            }
         }
         else if (target.starts_with("/api/v1/game/tick")) {
-            tick_handler_.HandleRequest(std::move(req), std::forward<Send>(send));
+            RunOnGameStrand(std::move(req), std::move(timed_send), [this](auto&& req, auto&& send) {
+                tick_handler_.HandleRequest(std::move(req), std::move(send));
+            });
         }
         else if (target.starts_with("/api/v1/game/records")) {
             if (req.method() != http::verb::get) {
-                SendErrorResponse(req, std::forward<Send>(send),
+                SendErrorResponse(req, std::move(timed_send),
                     http::status::method_not_allowed,
                     "methodNotAllowed", "Only GET method is allowed");
                 return;
             }
-            HandleGetRecords(std::forward<decltype(req)>(req), std::forward<Send>(send));
+            HandleGetRecords(std::forward<decltype(req)>(req), std::move(timed_send));
+        }
+        else if (target.substr(0, target.find('?')) == "/api/v1/metrics") {
+            HandleGetMetrics(std::forward<decltype(req)>(req), std::move(timed_send));
         }
         else if (target == "/api/v1/maps" || target.starts_with("/api/v1/maps/")) {
             if (req.method() != http::verb::get) {
-                SendErrorResponse(req, std::forward<Send>(send),
+                SendErrorResponse(req, std::move(timed_send),
                     http::status::method_not_allowed,
                     "methodNotAllowed", "Only GET method is allowed");
                 return;
             }
 
             if (target == "/api/v1/maps") {
-                HandleGetMapsList(std::forward<decltype(req)>(req), std::forward<Send>(send));
+                HandleGetMapsList(std::forward<decltype(req)>(req), std::move(timed_send));
             }
             else {
-                HandleGetMap(std::forward<decltype(req)>(req), std::forward<Send>(send));
+                HandleGetMap(std::forward<decltype(req)>(req), std::move(timed_send));
             }
         }
         else {
-            SendBadRequest(std::forward<Send>(send), "Bad request");
+            SendBadRequest(std::move(timed_send), "Bad request");
         }
     }
 
     template <typename Body, typename Allocator, typename Send>
-    void RequestHandler::HandleGetMapsList(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
-        json::array maps_json;
-
-        for (const auto& map : application_.GetGame().GetMaps()) {
-            json::object map_info;
-            map_info["id"] = *map.GetId();
-            map_info["name"] = map.GetName();
-            maps_json.push_back(std::move(map_info));
+    void RequestHandler::HandleGetMetrics(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
+        if (req.method() != http::verb::get && req.method() != http::verb::head) {
+            auto response = MakeErrorResponse(req, http::status::method_not_allowed,
+                "invalidMethod", "Invalid method");
+            response.set(http::field::allow, "GET, HEAD");
+            send(std::move(response));
+            return;
         }
 
+        std::string body = application_.GetMetrics().RenderPrometheus();
         http::response<http::string_body> response{ http::status::ok, req.version() };
-        response.set(http::field::content_type, "application/json");
+        response.set(http::field::content_type, "text/plain; version=0.0.4");
         response.set(http::field::cache_control, "no-cache");
-        response.body() = json::serialize(maps_json);
-        response.prepare_payload();
-
+        if (req.method() == http::verb::head) {
+            response.content_length(body.size());
+        }
+        else {
+            response.body() = std::move(body);
+            response.prepare_payload();
+        }
         send(std::move(response));
     }
 
+    template <typename Body, typename Allocator, typename Send>
+    void RequestHandler::HandleGetMapsList(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
+        SendCachedJson(req, std::forward<Send>(send), maps_list_cache_);
+    }
+
     template <typename Body, typename Allocator, typename Send>
     void RequestHandler::HandleGetMap(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
-        std::string map_id = ExtractMapId(req.target());
+        std::string_view map_id = ExtractMapId({ req.target().data(), req.target().size() });
 
         if (map_id.empty()) {
             SendErrorResponse(req, std::forward<Send>(send),
@@ -263,24 +623,186 @@ namespace http_handler {
             return;
         }
 
-        const model::Map* map = application_.GetGame().FindMap(model::Map::Id(map_id));
-        if (!map) {
+        auto cached = map_cache_.find(map_id);
+        if (cached == map_cache_.end()) {
             SendErrorResponse(req, std::forward<Send>(send),
                 http::status::not_found, "mapNotFound", "Map not found");
             return;
         }
 
-        json::object map_json = SerializeMap(*map);
+        SendCachedJson(req, std::forward<Send>(send), cached->second);
+    }
+
+    template <typename Body, typename Allocator, typename Send>
+    std::shared_ptr<const app::MapSnapshot> RequestHandler::AuthorizeSnapshotRequest(
+        const http::request<Body, http::basic_fields<Allocator>>& req, Send&& send) {
+        if (req.method() != http::verb::get && req.method() != http::verb::head) {
+            auto response = MakeErrorResponse(req, http::status::method_not_allowed,
+                "invalidMethod", "Invalid method");
+            response.set(http::field::allow, "GET, HEAD");
+            send(std::move(response));
+            return nullptr;
+        }
+
+        const auto player = AuthorizePlayer(req, send);
+        if (!player) {
+            return nullptr;
+        }
+
+        auto snapshot = application_.GetMapSnapshot(player->map_index);
+        if (!snapshot) {
+            SendErrorResponse(req, std::forward<Send>(send), http::status::unauthorized,
+                "unknownToken", "Player token has not been found");
+            return nullptr;
+        }
+        return snapshot;
+    }
+
+    template <typename Body, typename Allocator, typename Send>
+    std::optional<model::Game::PlayerRef> RequestHandler::AuthorizePlayer(
+        const http::request<Body, http::basic_fields<Allocator>>& req, Send&& send) {
+        auto token = ExtractBearerToken(req);
+        if (!token) {
+            SendErrorResponse(req, std::forward<Send>(send), http::status::unauthorized,
+                "invalidToken", "Authorization header is missing");
+            return std::nullopt;
+        }
+
+        if (const auto* owner = shard_map_ ? shard_map_->FindTokenOwnerUrl(*token) : nullptr) {
+            auto response = MakeErrorResponse(req, http::status::temporary_redirect,
+                "wrongShard", "Player is hosted by another node");
+            response.set(http::field::location, *owner + std::string(ToStringView(req.target())));
+            send(std::move(response));
+            return std::nullopt;
+        }
+
+        auto player = application_.GetGame().FindPlayerRefByToken(*token);
+        if (!player) {
+            SendErrorResponse(req, std::forward<Send>(send), http::status::unauthorized,
+                "unknownToken", "Player token has not been found");
+        }
+        return player;
+    }
+
+    template <typename Body, typename Allocator, typename Send>
+    void RequestHandler::HandlePlayerAction(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
+        if (req.method() != http::verb::post) {
+            auto response = MakeErrorResponse(req, http::status::method_not_allowed,
+                "invalidMethod", "Invalid method");
+            response.set(http::field::allow, "POST");
+            send(std::move(response));
+            return;
+        }
+
+        const auto player = AuthorizePlayer(req, send);
+        if (!player) {
+            return;
+        }
+
+        auto content_type = req.find(http::field::content_type);
+        if (content_type == req.end() || content_type->value() != "application/json") {
+            SendErrorResponse(req, std::forward<Send>(send), http::status::bad_request,
+                "invalidArgument", "Invalid content type");
+            return;
+        }
+
+        auto move = ParseMoveRequest(req.body());
+        if (!move) {
+            SendErrorResponse(req, std::forward<Send>(send), http::status::bad_request,
+                "invalidArgument", "Failed to parse action");
+            return;
+        }
+
+        // With the ticker running the move is picked up by the next tick anyway, so
+        // only the handle is queued and the player table is never read from here.
+        bool applied = true;
+        if (is_auto_tick_mode_) {
+            application_.QueuePlayerAction(player->handle, *move);
+        }
+        else {
+            applied = application_.SetPlayerAction(player->handle, *move);
+        }
+        if (!applied) {
+            SendErrorResponse(req, std::forward<Send>(send), http::status::unauthorized,
+                "unknownToken", "Player token has not been found");
+            return;
+        }
 
         http::response<http::string_body> response{ http::status::ok, req.version() };
         response.set(http::field::content_type, "application/json");
         response.set(http::field::cache_control, "no-cache");
-        response.body() = json::serialize(map_json);
+        response.body() = "{}";
         response.prepare_payload();
+        send(std::move(response));
+    }
 
+    template <typename Body, typename Allocator, typename Send>
+    void RequestHandler::HandlePlayerActions(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
+        if (req.method() != http::verb::post) {
+            auto response = MakeErrorResponse(req, http::status::method_not_allowed,
+                "invalidMethod", "Invalid method");
+            response.set(http::field::allow, "POST");
+            send(std::move(response));
+            return;
+        }
+
+        auto content_type = req.find(http::field::content_type);
+        if (content_type == req.end() || content_type->value() != "application/json") {
+            SendErrorResponse(req, std::forward<Send>(send), http::status::bad_request,
+                "invalidArgument", "Invalid content type");
+            return;
+        }
+
+        boost::system::error_code ec;
+        const auto value = json::parse(req.body(), ec);
+        auto actions = ec ? std::nullopt : ParseBatchActionRequest(value);
+        if (!actions) {
+            SendErrorResponse(req, std::forward<Send>(send), http::status::bad_request,
+                "invalidArgument", "Failed to parse actions");
+            return;
+        }
+
+        // A token that is malformed or unknown only rejects its own action.
+        std::vector<size_t> rejected;
+        const size_t accepted = is_auto_tick_mode_
+            ? application_.QueuePlayerActions(*actions, rejected)
+            : application_.SetPlayerActions(*actions, rejected);
+
+        json::object body;
+        body["accepted"] = accepted;
+        json::array rejected_json;
+        rejected_json.reserve(rejected.size());
+        for (const size_t index : rejected) {
+            rejected_json.push_back(index);
+        }
+        body["rejected"] = std::move(rejected_json);
+
+        http::response<http::string_body> response{ http::status::ok, req.version() };
+        response.set(http::field::content_type, "application/json");
+        response.set(http::field::cache_control, "no-cache");
+        response.body() = json::serialize(body);
+        response.prepare_payload();
         send(std::move(response));
     }
 
+    template <typename Body, typename Allocator, typename Send>
+    void RequestHandler::HandleGetGameState(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
+        if (auto snapshot = AuthorizeSnapshotRequest(req, send)) {
+            const bool binary = AcceptsBinaryState(req);
+            send(MakeSnapshotResponse(req,
+                { snapshot, binary ? &snapshot->binary_state : &snapshot->state }, binary));
+        }
+    }
+
+    template <typename Body, typename Allocator, typename Send>
+    void RequestHandler::HandleGetPlayers(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
+        if (auto snapshot = AuthorizeSnapshotRequest(req, send)) {
+            const bool binary = AcceptsBinaryState(req);
+            send(MakeSnapshotResponse(req,
+                { snapshot, binary ? &snapshot->binary_players : &snapshot->players }, binary));
+        }
+    }
+
     template <typename Body, typename Allocator, typename Send>
     void RequestHandler::HandleGetRecords(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send) {
         if (!database_) {
@@ -338,29 +860,57 @@ namespace http_handler {
             return;
         }
 
-        auto records = database_->GetRecords(start, max_items);
+        // The callback may run on a database pool thread; send is safe from any thread.
+        database_->GetRecords(start, max_items,
+            [this, req = std::move(req), send = std::forward<Send>(send)](
+                std::exception_ptr error, std::vector<app::db::RetiredPlayer> records) mutable {
+                if (error) {
+                    try {
+                        std::rethrow_exception(error);
+                    } catch (const boost::system::system_error&) {
+                        SendErrorResponse(req, send, http::status::service_unavailable,
+                            "serviceUnavailable", "Records are temporarily unavailable");
+                    } catch (const pqxx::broken_connection&) {
+                        SendErrorResponse(req, send, http::status::service_unavailable,
+                            "serviceUnavailable", "Records are temporarily unavailable");
+                    } catch (const std::exception& e) {
+                        std::cerr << "Failed to load records: " << e.what() << std::endl;
+                        SendErrorResponse(req, send, http::status::internal_server_error,
+                            "internalServerError", "Failed to load records");
+                    } catch (...) {
+                        std::cerr << "Failed to load records" << std::endl;
+                        SendErrorResponse(req, send, http::status::internal_server_error,
+                            "internalServerError", "Failed to load records");
+                    }
+                    return;
+                }
 
-        json::array records_json;
-        for (const auto& record : records) {
-            json::object record_json;
-            record_json["name"] = record.name;
-            record_json["score"] = record.score;
-            record_json["playTime"] = record.play_time_seconds;
-            records_json.push_back(std::move(record_json));
-        }
+                json::monotonic_resource arena;
+                json::array records_json(&arena);
+                records_json.reserve(records.size());
+                for (const auto& record : records) {
+                    json::object record_json(&arena);
+                    record_json["name"] = record.name;
+                    record_json["score"] = record.score;
+                    record_json["playTime"] = record.play_time_seconds;
+                    records_json.push_back(std::move(record_json));
+                }
 
-        http::response<http::string_body> response{ http::status::ok, req.version() };
-        response.set(http::field::content_type, "application/json");
-        response.set(http::field::cache_control, "no-cache");
-        response.body() = json::serialize(records_json);
-        response.prepare_payload();
-        response.set(http::field::content_length, std::to_string(response.body().size()));
+                http::response<http::string_body> response{ http::status::ok, req.version() };
+                response.set(http::field::content_type, "application/json");
+                response.set(http::field::cache_control, "no-cache");
+                response.body() = json::serialize(records_json);
+                response.prepare_payload();
 
-        send(std::move(response));
+                send(std::move(response));
+            });
     }
 
+    template <typename Send>
     void RequestHandler::SendBadRequest(Send&& send, std::string message) {
-        json::object error_json;
+        unsigned char buffer[512];
+        json::monotonic_resource arena{ buffer };
+        json::object error_json(&arena);
         error_json["code"] = "badRequest";
         error_json["message"] = message;
 
@@ -381,33 +931,13 @@ namespace http_handler {
         send(std::move(response));
     }
 
-    std::string RequestHandler::ExtractMapId(std::string_view path) {
+    std::string_view RequestHandler::ExtractMapId(std::string_view path) {
         return ::http_handler::ExtractMapId(path);
     }
 
     template void RequestHandler::operator() < http::string_body, std::allocator<char>,
-        std::function<void(http::response<http::string_body>&&)>>(
-            http::request<http::string_body, http::basic_fields<std::allocator<char>>>&&,
-            std::function<void(http::response<http::string_body>&&)>&&);
-
-    template void RequestHandler::HandleApiRequest<http::string_body, std::allocator<char>,
-        std::function<void(http::response<http::string_body>&&)>>(
-            http::request<http::string_body, http::basic_fields<std::allocator<char>>>&&,
-            std::function<void(http::response<http::string_body>&&)>&&);
-
-    template void RequestHandler::HandleGetMapsList<http::string_body, std::allocator<char>,
-        std::function<void(http::response<http::string_body>&&)>>(
-            http::request<http::string_body, http::basic_fields<std::allocator<char>>>&&,
-            std::function<void(http::response<http::string_body>&&)>&&);
-
-    template void RequestHandler::HandleGetMap<http::string_body, std::allocator<char>,
-        std::function<void(http::response<http::string_body>&&)>>(
-            http::request<http::string_body, http::basic_fields<std::allocator<char>>>&&,
-            std::function<void(http::response<http::string_body>&&)>&&);
-
-    template void RequestHandler::HandleGetRecords<http::string_body, std::allocator<char>,
-        std::function<void(http::response<http::string_body>&&)>>(
+        http_server::ResponseSender>(
             http::request<http::string_body, http::basic_fields<std::allocator<char>>>&&,
-            std::function<void(http::response<http::string_body>&&)>&&);
+            http_server::ResponseSender&&);
 
 }
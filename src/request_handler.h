@@ -3,49 +3,140 @@
 #include "http_server.h"
 #include "application.h"
 #include "join_handler.h"
-#include "players_handler.h"
-#include "game_state_handler.h"
-#include "player_action_handler.h"
+#include "sharding.h"
 #include "tick_handler.h"
+#include "static_file_cache.h"
+
+#include <boost/asio/dispatch.hpp>
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
 
 namespace http_handler {
 
+namespace net = boost::asio;
 namespace beast = boost::beast;
 namespace http = beast::http;
 
 class RequestHandler {
 public:
+    // game_strand is the one ticks run on: the game belongs to it, and joins, the
+    // tick endpoint and manual mode actions are run there. Everything else only
+    // reads published snapshots and the token index, and stays on the caller's thread.
     RequestHandler(app::Application& application, 
-                   net::strand<net::io_context::executor_type> strand,
+                   net::strand<net::io_context::executor_type> game_strand,
                    bool is_auto_tick_mode = false,
-                   app::db::Database* database = nullptr)
+                   app::db::Database* database = nullptr,
+                   std::filesystem::path www_root = {},
+                   const sharding::ShardMap* shard_map = nullptr)
         : application_(application)
-        , strand_(strand)
+        , game_strand_(game_strand)
         , is_auto_tick_mode_(is_auto_tick_mode)
         , database_(database)
-        , join_handler_(application)
-        , players_handler_(application)
-        , game_state_handler_(application)
-        , player_action_handler_(application)
+        , shard_map_(shard_map)
+        , file_cache_(std::move(www_root))
+        , join_handler_(application, shard_map)
         , tick_handler_(application) {
+        BuildMapCache();
     }
 
     RequestHandler(const RequestHandler&) = delete;
     RequestHandler& operator=(const RequestHandler&) = delete;
 
+    // send must accept http::response<http::string_body>, http_server::FileResponse
+    // and http_server::SharedResponse.
     template <typename Body, typename Allocator, typename Send>
     void operator()(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
 
 private:
+    // Maps are immutable after loading, so their JSON is serialized once and
+    // served with a strong ETag.
+    struct CachedJson {
+        std::string body;
+        std::string etag;
+    };
+
+    // Lets map_cache_ be searched with the string_view taken from the target.
+    struct StringHash {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view value) const noexcept {
+            return std::hash<std::string_view>{}(value);
+        }
+    };
+
     app::Application& application_;
-    net::strand<net::io_context::executor_type> strand_;
+    net::strand<net::io_context::executor_type> game_strand_;
     bool is_auto_tick_mode_;
     app::db::Database* database_;
+    // Requests carrying another node's token are redirected there.
+    const sharding::ShardMap* shard_map_;
+    StaticFileCache file_cache_;
     JoinHandler join_handler_;
-    PlayersHandler players_handler_;
-    GameStateHandler game_state_handler_;
-    PlayerActionHandler player_action_handler_;
     TickHandler tick_handler_;
+    std::shared_ptr<const CachedJson> maps_list_cache_;
+    std::unordered_map<std::string, std::shared_ptr<const CachedJson>, StringHash, std::equal_to<>> map_cache_;
+
+    void BuildMapCache();
+
+    // Records the route's latency when the response is sent: joins, ticks, manual
+    // actions and records misses are answered on another thread, long after routing.
+    template <typename Send>
+    class TimedSend {
+    public:
+        TimedSend(Send send, metrics::Registry& registry, metrics::Route route) noexcept
+            : send_(std::move(send))
+            , registry_(registry.Enabled() ? &registry : nullptr)
+            , route_(route) {
+            if (registry_) {
+                start_ = Clock::now();
+            }
+        }
+
+        template <typename Response>
+        void operator()(Response&& response) const {
+            Record();
+            send_(std::forward<Response>(response));
+        }
+
+        // For handlers that take the plain sender; they answer before returning, so
+        // Record goes right after them.
+        const Send& Unwrap() const noexcept {
+            return send_;
+        }
+
+        void Record() const noexcept {
+            if (registry_) {
+                registry_->RecordRoute(route_, Clock::now() - start_);
+            }
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        Send send_;
+        metrics::Registry* registry_;
+        metrics::Route route_;
+        Clock::time_point start_;
+    };
+
+    // handler(req, send) runs on game_strand_ once the strand gets to it.
+    template <typename Body, typename Allocator, typename Send, typename Handler>
+    void RunOnGameStrand(http::request<Body, http::basic_fields<Allocator>>&& req, TimedSend<Send>&& send,
+        Handler handler) {
+        net::dispatch(game_strand_,
+            [req = std::move(req), send = std::move(send), handler = std::move(handler)]() mutable {
+                handler(std::move(req), Send{ send.Unwrap() });
+                send.Record();
+            });
+    }
+
+    template <typename Body, typename Allocator, typename Send>
+    void SendCachedJson(const http::request<Body, http::basic_fields<Allocator>>& req, Send&& send,
+                        const std::shared_ptr<const CachedJson>& cached);
     
     template <typename Body, typename Allocator, typename Send>
     void HandleFileRequest(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
@@ -53,23 +144,52 @@ private:
     template <typename Body, typename Allocator, typename Send>
     void HandleApiRequest(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
     
+    // Prometheus text exposition of application_.GetMetrics().
+    template <typename Body, typename Allocator, typename Send>
+    void HandleGetMetrics(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
+
     template <typename Body, typename Allocator, typename Send>
     void HandleGetMapsList(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
     
     template <typename Body, typename Allocator, typename Send>
     void HandleGetMap(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
     
+    // Both answer from the per-map snapshot published by the application.
+    template <typename Body, typename Allocator, typename Send>
+    void HandleGetGameState(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
+
+    template <typename Body, typename Allocator, typename Send>
+    void HandleGetPlayers(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
+
+    template <typename Body, typename Allocator, typename Send>
+    void HandlePlayerAction(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
+
+    // Moves for many players in one request, each authorized by its own token, so a
+    // bot fleet needs one round trip per tick instead of one per player.
+    template <typename Body, typename Allocator, typename Send>
+    void HandlePlayerActions(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
+
+    // Resolves the bearer token through the token index only, so it is safe on any
+    // thread; the handle is checked again wherever the player is used.
+    template <typename Body, typename Allocator, typename Send>
+    std::optional<model::Game::PlayerRef> AuthorizePlayer(const http::request<Body, http::basic_fields<Allocator>>& req, Send&& send);
+
+    template <typename Body, typename Allocator, typename Send>
+    std::shared_ptr<const app::MapSnapshot> AuthorizeSnapshotRequest(
+        const http::request<Body, http::basic_fields<Allocator>>& req, Send&& send);
+
     template <typename Body, typename Allocator, typename Send>
     void HandleGetRecords(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send);
 
+    template <typename Send>
     void SendBadRequest(Send&& send, std::string message);
     
-    template <typename Request>
+    template <typename Request, typename Send>
     void SendErrorResponse(Request&& req, Send&& send, 
                           http::status status, 
                           std::string code, std::string message);
 
-    std::string ExtractMapId(std::string_view path);
+    std::string_view ExtractMapId(std::string_view path);
 };
 
 }
@@ -0,0 +1,79 @@
+#include "sharding.h"
+
+#include <stdexcept>
+
+using namespace std::literals;
+
+namespace sharding {
+
+    ShardMap::ShardMap(const model::Game& game, const std::vector<ShardConfig>& shards, uint8_t local_shard)
+        : local_shard_(local_shard) {
+        constexpr uint8_t UNASSIGNED = 0xFF;
+        std::vector<uint8_t> owners(game.GetMaps().size(), UNASSIGNED);
+        std::vector<std::string> urls;
+        bool has_local = false;
+
+        for (const auto& shard : shards) {
+            if (shard.id == UNASSIGNED) {
+                throw std::invalid_argument("Shard id 255 is reserved");
+            }
+            if (shard.id < urls.size() && !urls[shard.id].empty()) {
+                throw std::invalid_argument("Duplicate shard id "s + std::to_string(shard.id));
+            }
+            if (shard.url.empty()) {
+                throw std::invalid_argument("Shard "s + std::to_string(shard.id) + " has no url"s);
+            }
+            if (shard.id >= urls.size()) {
+                urls.resize(shard.id + 1);
+            }
+            urls[shard.id] = shard.url;
+            has_local = has_local || shard.id == local_shard;
+
+            for (const auto& map_id : shard.map_ids) {
+                const auto index = game.FindMapIndex(map_id);
+                if (!index) {
+                    throw std::invalid_argument("Shard "s + std::to_string(shard.id) + " owns unknown map "s + map_id);
+                }
+                if (owners[*index] != UNASSIGNED) {
+                    throw std::invalid_argument("Map "s + map_id + " is owned by more than one shard"s);
+                }
+                owners[*index] = shard.id;
+            }
+        }
+
+        if (!has_local) {
+            throw std::invalid_argument("Shard "s + std::to_string(local_shard) + " is not configured"s);
+        }
+        for (size_t i = 0; i < owners.size(); ++i) {
+            if (owners[i] == UNASSIGNED) {
+                throw std::invalid_argument("Map "s + *game.GetMaps()[i].GetId() + " is not owned by any shard"s);
+            }
+        }
+
+        map_owners_ = std::move(owners);
+        urls_ = std::move(urls);
+    }
+
+    const std::string* ShardMap::FindMapOwnerUrl(model::MapIndex map_index) const noexcept {
+        if (IsLocal(map_index)) {
+            return nullptr;
+        }
+        return &urls_[map_owners_[map_index]];
+    }
+
+    const std::string* ShardMap::FindTokenOwnerUrl(std::string_view token) const noexcept {
+        if (!IsSharded()) {
+            return nullptr;
+        }
+        const auto parsed = model::Token::Parse(token);
+        if (!parsed) {
+            return nullptr;
+        }
+        const uint8_t shard = GetTokenShard(*parsed);
+        if (shard == local_shard_ || shard >= urls_.size() || urls_[shard].empty()) {
+            return nullptr;
+        }
+        return &urls_[shard];
+    }
+
+}  // namespace sharding
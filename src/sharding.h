@@ -0,0 +1,71 @@
+#pragma once
+#include "model.h"
+#include "token_index.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sharding {
+
+    // One node of a sharded deployment: the maps it owns and the base URL other
+    // nodes redirect their clients to, e.g. "http://10.0.0.2:8080".
+    struct ShardConfig {
+        uint8_t id;
+        std::string url;
+        std::vector<std::string> map_ids;
+    };
+
+    // Every node loads the whole config, so they all serve the same /api/v1/maps,
+    // but only the node owning a map accepts joins to it. Tokens carry the id of
+    // the node that issued them, so a request can be sent on to its player's node
+    // without a shared session store.
+    class ShardMap {
+    public:
+        // A single node that owns every map.
+        ShardMap() = default;
+
+        // Throws std::invalid_argument unless every map of game is owned by exactly
+        // one of shards and local_shard is among them.
+        ShardMap(const model::Game& game, const std::vector<ShardConfig>& shards, uint8_t local_shard);
+
+        bool IsSharded() const noexcept {
+            return !map_owners_.empty();
+        }
+
+        uint8_t GetLocalShard() const noexcept {
+            return local_shard_;
+        }
+
+        bool IsLocal(model::MapIndex map_index) const noexcept {
+            return !IsSharded() || map_owners_[map_index] == local_shard_;
+        }
+
+        // Base URL of the node that owns the map; nullptr when it is this one.
+        const std::string* FindMapOwnerUrl(model::MapIndex map_index) const noexcept;
+
+        // Base URL of the node that issued the token; nullptr when it is this one,
+        // or when the token names no known node.
+        const std::string* FindTokenOwnerUrl(std::string_view token) const noexcept;
+
+        // The issuing node is stored in the lowest byte of the token.
+        static uint8_t GetTokenShard(const model::Token& token) noexcept {
+            return static_cast<uint8_t>(token.lo & 0xFF);
+        }
+
+        static model::Token WithShard(model::Token token, uint8_t shard) noexcept {
+            token.lo = (token.lo & ~uint64_t{ 0xFF }) | shard;
+            return token;
+        }
+
+    private:
+        uint8_t local_shard_ = 0;
+        // Indexed by model::MapIndex; empty when not sharded.
+        std::vector<uint8_t> map_owners_;
+        // Indexed by shard id; empty for ids that are not configured.
+        std::vector<std::string> urls_;
+    };
+
+}  // namespace sharding
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace util {
+
+// Dense vector of values addressed through generational handles. Insert and Erase are
+// O(1); Erase moves the last value into the freed position, so dense indices change
+// but handles stay valid until their own value is erased.
+template <typename T>
+class SlotMap {
+public:
+    struct Handle {
+        uint32_t index = std::numeric_limits<uint32_t>::max();
+        uint32_t generation = 0;
+
+        auto operator<=>(const Handle&) const = default;
+    };
+
+    Handle Insert(T value) {
+        uint32_t slot_index;
+        if (!free_slots_.empty()) {
+            slot_index = free_slots_.back();
+            free_slots_.pop_back();
+        } else {
+            slot_index = static_cast<uint32_t>(slots_.size());
+            slots_.push_back({ 0, 0 });
+        }
+
+        try {
+            values_.push_back(std::move(value));
+            dense_to_slot_.push_back(slot_index);
+        } catch (...) {
+            if (values_.size() > dense_to_slot_.size()) {
+                values_.pop_back();
+            }
+            free_slots_.push_back(slot_index);
+            throw;
+        }
+
+        Slot& slot = slots_[slot_index];
+        slot.dense = static_cast<uint32_t>(values_.size() - 1);
+        return { slot_index, slot.generation };
+    }
+
+    bool Erase(Handle handle) {
+        auto dense = DenseIndex(handle);
+        if (!dense) {
+            return false;
+        }
+
+        const size_t last = values_.size() - 1;
+        if (*dense != last) {
+            values_[*dense] = std::move(values_.back());
+            dense_to_slot_[*dense] = dense_to_slot_[last];
+            slots_[dense_to_slot_[*dense]].dense = static_cast<uint32_t>(*dense);
+        }
+        values_.pop_back();
+        dense_to_slot_.pop_back();
+
+        ++slots_[handle.index].generation;
+        free_slots_.push_back(handle.index);
+        return true;
+    }
+
+    std::optional<size_t> DenseIndex(Handle handle) const noexcept {
+        if (handle.index >= slots_.size() || slots_[handle.index].generation != handle.generation) {
+            return std::nullopt;
+        }
+        return slots_[handle.index].dense;
+    }
+
+    T* Find(Handle handle) noexcept {
+        auto dense = DenseIndex(handle);
+        return dense ? &values_[*dense] : nullptr;
+    }
+
+    const T* Find(Handle handle) const noexcept {
+        auto dense = DenseIndex(handle);
+        return dense ? &values_[*dense] : nullptr;
+    }
+
+    T& operator[](size_t dense) noexcept {
+        return values_[dense];
+    }
+
+    const T& operator[](size_t dense) const noexcept {
+        return values_[dense];
+    }
+
+    size_t Size() const noexcept {
+        return values_.size();
+    }
+
+    bool Empty() const noexcept {
+        return values_.empty();
+    }
+
+    void Reserve(size_t capacity) {
+        values_.reserve(capacity);
+        dense_to_slot_.reserve(capacity);
+        slots_.reserve(capacity);
+    }
+
+    auto begin() noexcept { return values_.begin(); }
+    auto end() noexcept { return values_.end(); }
+    auto begin() const noexcept { return values_.begin(); }
+    auto end() const noexcept { return values_.end(); }
+
+private:
+    struct Slot {
+        uint32_t dense;
+        uint32_t generation;
+    };
+
+    std::vector<T> values_;
+    std::vector<uint32_t> dense_to_slot_;
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> free_slots_;
+};
+
+}  // namespace util
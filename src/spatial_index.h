@@ -0,0 +1,90 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace model {
+
+    template <typename Key>
+    class SpatialIndex {
+    public:
+        struct Entry {
+            Key key;
+            double x;
+            double y;
+        };
+
+        explicit SpatialIndex(double cell_size = 8.0) noexcept
+            : cell_size_(cell_size) {
+        }
+
+        void Insert(Key key, double x, double y) {
+            cells_[CellKey(CellOf(x), CellOf(y))].push_back({ std::move(key), x, y });
+        }
+
+        void Erase(const Key& key, double x, double y) {
+            auto it = cells_.find(CellKey(CellOf(x), CellOf(y)));
+            if (it == cells_.end()) {
+                return;
+            }
+
+            auto& entries = it->second;
+            auto entry = std::find_if(entries.begin(), entries.end(),
+                [&key](const Entry& e) { return e.key == key; });
+            if (entry == entries.end()) {
+                return;
+            }
+
+            *entry = std::move(entries.back());
+            entries.pop_back();
+            if (entries.empty()) {
+                cells_.erase(it);
+            }
+        }
+
+        void Clear() noexcept {
+            cells_.clear();
+        }
+
+        // Visits every entry whose cell intersects the bounding box of the segment
+        // (x0, y0)-(x1, y1) widened by radius. Each entry is visited at most once.
+        template <typename Fn>
+        void ForEachCandidate(double x0, double y0, double x1, double y1, double radius, Fn&& fn) const {
+            if (cells_.empty()) {
+                return;
+            }
+
+            const int64_t min_cx = CellOf(std::min(x0, x1) - radius);
+            const int64_t max_cx = CellOf(std::max(x0, x1) + radius);
+            const int64_t min_cy = CellOf(std::min(y0, y1) - radius);
+            const int64_t max_cy = CellOf(std::max(y0, y1) + radius);
+
+            for (int64_t cx = min_cx; cx <= max_cx; ++cx) {
+                for (int64_t cy = min_cy; cy <= max_cy; ++cy) {
+                    auto it = cells_.find(CellKey(cx, cy));
+                    if (it == cells_.end()) {
+                        continue;
+                    }
+                    for (const auto& entry : it->second) {
+                        fn(entry);
+                    }
+                }
+            }
+        }
+
+    private:
+        int64_t CellOf(double coord) const noexcept {
+            return static_cast<int64_t>(std::floor(coord / cell_size_));
+        }
+
+        static uint64_t CellKey(int64_t cx, int64_t cy) noexcept {
+            return (static_cast<uint64_t>(cx) << 32) ^ static_cast<uint32_t>(cy);
+        }
+
+        double cell_size_;
+        std::unordered_map<uint64_t, std::vector<Entry>> cells_;
+    };
+
+}  // namespace model
@@ -0,0 +1,135 @@
+#include "state_file.h"
+
+#include <cerrno>
+#include <iostream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace app::state_file {
+
+    namespace {
+
+        [[noreturn]] void ThrowErrno(const std::string& what) {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        class FileDescriptor {
+        public:
+            explicit FileDescriptor(int fd) noexcept
+                : fd_(fd) {
+            }
+
+            ~FileDescriptor() {
+                if (fd_ >= 0) {
+                    ::close(fd_);
+                }
+            }
+
+            FileDescriptor(const FileDescriptor&) = delete;
+            FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+            int Get() const noexcept {
+                return fd_;
+            }
+
+            // Reports a failed close; a write error may only surface here.
+            void Close() {
+                const int fd = fd_;
+                fd_ = -1;
+                if (::close(fd) != 0) {
+                    ThrowErrno("close");
+                }
+            }
+
+        private:
+            int fd_;
+        };
+
+    }  // namespace
+
+    void WriteAtomically(const std::filesystem::path& path, std::string_view bytes) {
+        auto tmp_path = path;
+        tmp_path += ".tmp";
+
+        FileDescriptor fd{ ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) };
+        if (fd.Get() < 0) {
+            ThrowErrno("Failed to create " + tmp_path.string());
+        }
+        while (!bytes.empty()) {
+            const ssize_t written = ::write(fd.Get(), bytes.data(), bytes.size());
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ThrowErrno("Failed to write " + tmp_path.string());
+            }
+            bytes.remove_prefix(static_cast<size_t>(written));
+        }
+        if (::fdatasync(fd.Get()) != 0) {
+            ThrowErrno("Failed to sync " + tmp_path.string());
+        }
+        fd.Close();
+
+        if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            ThrowErrno("Failed to replace " + path.string());
+        }
+    }
+
+    StateFileWriter::StateFileWriter(std::filesystem::path path)
+        : path_(std::move(path))
+        , thread_([this] { Run(); }) {
+    }
+
+    StateFileWriter::~StateFileWriter() {
+        Stop();
+    }
+
+    void StateFileWriter::Submit(std::string state) {
+        {
+            std::lock_guard lock{ mutex_ };
+            pending_ = std::move(state);
+        }
+        cond_var_.notify_one();
+    }
+
+    void StateFileWriter::Stop() {
+        {
+            std::lock_guard lock{ mutex_ };
+            stopping_ = true;
+        }
+        cond_var_.notify_one();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void StateFileWriter::Run() {
+        std::unique_lock lock{ mutex_ };
+        while (true) {
+            cond_var_.wait(lock, [this] {
+                return stopping_ || pending_;
+            });
+
+            if (pending_) {
+                std::string state = std::move(*pending_);
+                pending_.reset();
+
+                lock.unlock();
+                try {
+                    WriteAtomically(path_, state);
+                } catch (const std::exception& e) {
+                    std::cerr << "Failed to save game state: " << e.what() << std::endl;
+                }
+                lock.lock();
+                continue;
+            }
+
+            if (stopping_) {
+                return;
+            }
+        }
+    }
+
+}  // namespace app::state_file
@@ -0,0 +1,145 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+// Saved game state, restored on startup so a restart or redeploy keeps every
+// session. Version 1, fixed-width little-endian fields:
+//
+//   file    := magic:'G' 'S' 'A' 'V'  version:u32 = 1  tick:u64  next_dog_id:u32
+//              next_player_id:u32  next_loot_id:i32  map_count:u32 map*
+//              player_count:u32 player*
+//   map     := id:str  loot_count:u32 loot*
+//   loot    := id:i32  type:i32  value:f64  x:f64  y:f64
+//   player  := player_id:u32  dog_id:u32  name:str  token_hi:u64  token_lo:u64
+//              map:u32  x:f64  y:f64  vx:f64  vy:f64  dir:u8  bag_capacity:i32
+//              score:i32  bag_count:u32 (item_id:i32 item_type:i32 item_value:f64)*
+//              play_time_ms:i64  idle_ms:i64
+//   str     := size:u32 u8[size]
+//
+// map is an index into the file's own map list; maps are matched to the config
+// by id. idle_ms is -1 for a dog that is moving. Doubles are stored bit-exact, so
+// a restored dog continues from exactly where it was.
+namespace app::state_file {
+
+    static_assert(std::endian::native == std::endian::little, "state files are little-endian");
+
+    inline constexpr char MAGIC[4] = { 'G', 'S', 'A', 'V' };
+    inline constexpr uint32_t FORMAT_VERSION = 1;
+
+    // Fields are copied into a presized buffer; a save runs on the tick, so it
+    // avoids a std::string::append per field.
+    class Writer {
+    public:
+        explicit Writer(size_t size_hint)
+            : out_(size_hint, '\0') {
+        }
+
+        template <typename T>
+        void Put(T value) {
+            static_assert(std::is_arithmetic_v<T>);
+            std::memcpy(Grow(sizeof(T)), &value, sizeof(T));
+        }
+
+        void Bytes(std::string_view value) {
+            Put(static_cast<uint32_t>(value.size()));
+            std::memcpy(Grow(value.size()), value.data(), value.size());
+        }
+
+        std::string Take() {
+            out_.resize(size_);
+            return std::move(out_);
+        }
+
+    private:
+        char* Grow(size_t size) {
+            if (out_.size() - size_ < size) {
+                out_.resize(std::max(out_.size() * 2, size_ + size));
+            }
+            char* at = out_.data() + size_;
+            size_ += size;
+            return at;
+        }
+
+        std::string out_;
+        size_t size_ = 0;
+    };
+
+    // Reads straight out of the file, usually a util::MappedFile; throws
+    // std::invalid_argument when the data ends early.
+    class Reader {
+    public:
+        explicit Reader(std::string_view in)
+            : in_(in) {
+        }
+
+        template <typename T>
+        T Get() {
+            static_assert(std::is_arithmetic_v<T>);
+            T value;
+            std::memcpy(&value, Take(sizeof(T)).data(), sizeof(T));
+            return value;
+        }
+
+        std::string_view Bytes() {
+            return Take(Get<uint32_t>());
+        }
+
+        std::string_view Take(size_t size) {
+            if (size > in_.size() - pos_) {
+                throw std::invalid_argument("Truncated state file");
+            }
+            auto bytes = in_.substr(pos_, size);
+            pos_ += size;
+            return bytes;
+        }
+
+        bool AtEnd() const noexcept {
+            return pos_ == in_.size();
+        }
+
+    private:
+        std::string_view in_;
+        size_t pos_ = 0;
+    };
+
+    // Writes to a temporary file next to path, fsyncs it and renames it over path,
+    // so a crash leaves either the old state or the new one.
+    void WriteAtomically(const std::filesystem::path& path, std::string_view bytes);
+
+    // Writes saved states on a background thread. Only the newest pending state is
+    // kept: if the disk falls behind, intermediate saves are skipped, never queued.
+    // Stop() writes whatever is pending before returning.
+    class StateFileWriter {
+    public:
+        explicit StateFileWriter(std::filesystem::path path);
+        ~StateFileWriter();
+
+        StateFileWriter(const StateFileWriter&) = delete;
+        StateFileWriter& operator=(const StateFileWriter&) = delete;
+
+        void Submit(std::string state);
+        void Stop();
+
+    private:
+        void Run();
+
+        std::filesystem::path path_;
+        std::mutex mutex_;
+        std::condition_variable cond_var_;
+        std::optional<std::string> pending_;
+        bool stopping_ = false;
+        std::thread thread_;
+    };
+
+}  // namespace app::state_file
@@ -0,0 +1,175 @@
+#include "state_updates.h"
+
+#include <algorithm>
+#include <boost/json.hpp>
+
+namespace http_handler {
+
+    namespace http = boost::beast::http;
+    namespace json = boost::json;
+
+    using namespace std::literals;
+
+    namespace {
+
+        http::response<http::string_body> MakeRejection(const http_server::Request& req, http::status status,
+            std::string_view code, std::string_view message) {
+            http::response<http::string_body> response{ status, req.version() };
+            response.set(http::field::content_type, "application/json");
+            response.set(http::field::cache_control, "no-cache");
+            response.body() = json::serialize(json::object{ { "code", code }, { "message", message } });
+            return response;
+        }
+
+        // Browsers cannot set headers on a WebSocket handshake, so the token may also
+        // come as ?token=<hex>.
+        std::optional<std::string> ExtractToken(const http_server::Request& req) {
+            std::string_view token;
+            if (auto it = req.find(http::field::authorization); it != req.end()) {
+                std::string_view value{ it->value().data(), it->value().size() };
+                if (value.starts_with("Bearer "sv)) {
+                    token = value.substr("Bearer "sv.size());
+                }
+            }
+            else {
+                std::string_view target{ req.target().data(), req.target().size() };
+                if (auto pos = target.find("token="sv); pos != std::string_view::npos) {
+                    token = target.substr(pos + "token="sv.size());
+                    token = token.substr(0, token.find('&'));
+                }
+            }
+
+            if (token.size() != 32 || token.find_first_not_of("0123456789abcdefABCDEF") != std::string_view::npos) {
+                return std::nullopt;
+            }
+            return std::string(token);
+        }
+
+        std::optional<uint64_t> ParseAck(std::string_view message) {
+            boost::system::error_code ec;
+            auto value = json::parse(message, ec);
+            if (ec || !value.is_object()) {
+                return std::nullopt;
+            }
+            const auto* ack = value.as_object().if_contains("ack");
+            if (!ack || !ack->is_int64() || ack->as_int64() < 0) {
+                return std::nullopt;
+            }
+            return static_cast<uint64_t>(ack->as_int64());
+        }
+
+    }  // namespace
+
+    StateUpdates::StateUpdates(app::Application& application, size_t keyframe_interval)
+        : application_(application)
+        , keyframe_interval_(std::max<size_t>(1, keyframe_interval)) {
+        for (size_t i = 0; i < application.GetGame().GetMaps().size(); ++i) {
+            channels_.push_back(std::make_unique<MapChannel>());
+        }
+    }
+
+    void StateUpdates::HandleUpgrade(http_server::Request&& req, std::shared_ptr<http_server::WebSocketSession> session) {
+        std::string_view target{ req.target().data(), req.target().size() };
+        if (target.substr(0, target.find('?')) != "/api/v1/game/updates"sv) {
+            return session->Reject(MakeRejection(req, http::status::not_found, "notFound", "Not found"));
+        }
+
+        auto token = ExtractToken(req);
+        if (!token) {
+            return session->Reject(MakeRejection(req, http::status::unauthorized,
+                "invalidToken", "Authorization token is missing"));
+        }
+
+        // Upgrades arrive on io_context workers, so only the token index and the
+        // published snapshot are read here, never the player table.
+        const auto player = application_.GetGame().FindPlayerRefByToken(*token);
+        auto snapshot = player ? application_.GetMapSnapshot(player->map_index) : nullptr;
+        if (!snapshot) {
+            return session->Reject(MakeRejection(req, http::status::unauthorized,
+                "unknownToken", "Player token has not been found"));
+        }
+
+        auto subscriber = std::make_shared<Subscriber>();
+        subscriber->session = session;
+
+        session->Accept(std::move(req),
+            [subscriber](std::string_view message) {
+                if (auto ack = ParseAck(message)) {
+                    uint64_t acked = subscriber->acked_tick.load();
+                    while (acked < *ack && !subscriber->acked_tick.compare_exchange_weak(acked, *ack)) {
+                    }
+                }
+            },
+            [this, map_index = player->map_index, raw = subscriber.get()] {
+                Unsubscribe(map_index, raw);
+            });
+        session->Send(std::make_shared<const std::string>(app::BuildKeyframeMessage(*snapshot)));
+
+        auto& channel = *channels_[player->map_index];
+        std::lock_guard lock{ channel.mutex };
+        channel.subscribers.push_back(std::move(subscriber));
+    }
+
+    void StateUpdates::Publish(size_t map_index, std::shared_ptr<const app::MapSnapshot> snapshot) {
+        auto& channel = *channels_[map_index];
+        std::lock_guard lock{ channel.mutex };
+
+        channel.history.push_back(snapshot);
+        if (channel.history.size() > keyframe_interval_) {
+            channel.history.pop_front();
+        }
+        if (channel.subscribers.empty()) {
+            return;
+        }
+
+        const bool keyframe_due = snapshot->tick % keyframe_interval_ == 0;
+        std::shared_ptr<const std::string> keyframe;
+        // Clients that acknowledged the same tick share one encoded delta.
+        std::vector<std::pair<uint64_t, std::shared_ptr<const std::string>>> deltas;
+
+        std::erase_if(channel.subscribers, [&](const std::shared_ptr<Subscriber>& subscriber) {
+            auto session = subscriber->session.lock();
+            if (!session) {
+                return true;
+            }
+            // Deltas are relative to the last ack, so a backed-up client loses
+            // nothing by skipping a tick.
+            if (session->PendingMessages() > 1) {
+                return false;
+            }
+
+            const uint64_t base_tick = subscriber->acked_tick.load();
+            if (base_tick == snapshot->tick) {
+                return false;
+            }
+            auto base = std::find_if(channel.history.rbegin(), channel.history.rend(),
+                [base_tick](const auto& entry) { return entry->tick == base_tick; });
+
+            if (keyframe_due || base == channel.history.rend()) {
+                if (!keyframe) {
+                    keyframe = std::make_shared<const std::string>(app::BuildKeyframeMessage(*snapshot));
+                }
+                session->Send(keyframe);
+                return false;
+            }
+
+            auto delta = std::find_if(deltas.begin(), deltas.end(),
+                [base_tick](const auto& entry) { return entry.first == base_tick; });
+            if (delta == deltas.end()) {
+                deltas.emplace_back(base_tick, std::make_shared<const std::string>(app::BuildDeltaMessage(**base, *snapshot)));
+                delta = std::prev(deltas.end());
+            }
+            session->Send(delta->second);
+            return false;
+        });
+    }
+
+    void StateUpdates::Unsubscribe(size_t map_index, const Subscriber* subscriber) {
+        auto& channel = *channels_[map_index];
+        std::lock_guard lock{ channel.mutex };
+        std::erase_if(channel.subscribers, [subscriber](const auto& entry) {
+            return entry.get() == subscriber;
+        });
+    }
+
+}  // namespace http_handler
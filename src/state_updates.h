@@ -0,0 +1,48 @@
+#pragma once
+#include "http_server.h"
+#include "application.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace http_handler {
+
+    // Pushes map state to WebSocket subscribers of /api/v1/game/updates after every
+    // tick. A client acknowledges the ticks it has applied with {"ack": <tick>} and
+    // is then sent deltas against that snapshot. It gets a keyframe instead every
+    // keyframe_interval ticks, and whenever its base has left the history.
+    class StateUpdates {
+    public:
+        explicit StateUpdates(app::Application& application, size_t keyframe_interval = 20);
+
+        StateUpdates(const StateUpdates&) = delete;
+        StateUpdates& operator=(const StateUpdates&) = delete;
+
+        void HandleUpgrade(http_server::Request&& req, std::shared_ptr<http_server::WebSocketSession> session);
+
+        // Called by the application after each tick, once per map.
+        void Publish(size_t map_index, std::shared_ptr<const app::MapSnapshot> snapshot);
+
+    private:
+        struct Subscriber {
+            std::weak_ptr<http_server::WebSocketSession> session;
+            std::atomic<uint64_t> acked_tick{ 0 };
+        };
+
+        struct MapChannel {
+            std::mutex mutex;
+            std::vector<std::shared_ptr<Subscriber>> subscribers;
+            std::deque<std::shared_ptr<const app::MapSnapshot>> history;
+        };
+
+        void Unsubscribe(size_t map_index, const Subscriber* subscriber);
+
+        app::Application& application_;
+        size_t keyframe_interval_;
+        std::vector<std::unique_ptr<MapChannel>> channels_;
+    };
+
+}  // namespace http_handler
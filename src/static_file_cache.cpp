@@ -0,0 +1,239 @@
+#include "static_file_cache.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+namespace http_handler {
+
+    namespace fs = std::filesystem;
+
+    using namespace std::literals;
+
+    namespace {
+
+        std::string_view GetContentType(const fs::path& path) {
+            static constexpr std::array<std::pair<std::string_view, std::string_view>, 20> content_types{ {
+                { ".htm"sv, "text/html"sv },
+                { ".html"sv, "text/html"sv },
+                { ".css"sv, "text/css"sv },
+                { ".txt"sv, "text/plain"sv },
+                { ".js"sv, "text/javascript"sv },
+                { ".json"sv, "application/json"sv },
+                { ".xml"sv, "application/xml"sv },
+                { ".wasm"sv, "application/wasm"sv },
+                { ".png"sv, "image/png"sv },
+                { ".jpg"sv, "image/jpeg"sv },
+                { ".jpe"sv, "image/jpeg"sv },
+                { ".jpeg"sv, "image/jpeg"sv },
+                { ".gif"sv, "image/gif"sv },
+                { ".bmp"sv, "image/bmp"sv },
+                { ".ico"sv, "image/vnd.microsoft.icon"sv },
+                { ".tiff"sv, "image/tiff"sv },
+                { ".tif"sv, "image/tiff"sv },
+                { ".svg"sv, "image/svg+xml"sv },
+                { ".svgz"sv, "image/svg+xml"sv },
+                { ".mp3"sv, "audio/mpeg"sv },
+            } };
+
+            std::string extension = path.extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(),
+                [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+            for (const auto& [ext, type] : content_types) {
+                if (ext == extension) {
+                    return type;
+                }
+            }
+            return "application/octet-stream"sv;
+        }
+
+        std::string MakeFileETag(std::chrono::system_clock::time_point modified_at, std::uint64_t size) {
+            std::ostringstream etag;
+            etag << '"' << std::hex << modified_at.time_since_epoch().count() << '-' << size << '"';
+            return etag.str();
+        }
+
+        std::optional<std::chrono::system_clock::time_point> GetModifiedAt(const fs::path& path) {
+            std::error_code ec;
+            auto ftime = fs::last_write_time(path, ec);
+            if (ec) {
+                return std::nullopt;
+            }
+            return std::chrono::time_point_cast<std::chrono::system_clock::duration>(
+                std::chrono::file_clock::to_sys(ftime));
+        }
+
+        int HexValue(char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+    }  // namespace
+
+    std::string FormatHttpDate(std::chrono::system_clock::time_point time) {
+        const std::time_t t = std::chrono::system_clock::to_time_t(time);
+        std::tm tm{};
+        gmtime_r(&t, &tm);
+
+        std::ostringstream out;
+        out.imbue(std::locale::classic());
+        out << std::put_time(&tm, "%a, %d %b %Y %H:%M:%S GMT");
+        return out.str();
+    }
+
+    std::optional<std::chrono::system_clock::time_point> ParseHttpDate(std::string_view date) {
+        std::tm tm{};
+        std::istringstream in{ std::string(date) };
+        in.imbue(std::locale::classic());
+        in >> std::get_time(&tm, "%a, %d %b %Y %H:%M:%S");
+        if (in.fail()) {
+            return std::nullopt;
+        }
+        return std::chrono::system_clock::from_time_t(timegm(&tm));
+    }
+
+    std::optional<std::string> DecodeUrlPath(std::string_view target) {
+        target = target.substr(0, target.find_first_of("?#"));
+
+        std::string path;
+        path.reserve(target.size());
+        for (size_t i = 0; i < target.size(); ++i) {
+            if (target[i] == '%') {
+                if (i + 2 >= target.size()) {
+                    return std::nullopt;
+                }
+                const int hi = HexValue(target[i + 1]);
+                const int lo = HexValue(target[i + 2]);
+                if (hi < 0 || lo < 0) {
+                    return std::nullopt;
+                }
+                path.push_back(static_cast<char>(hi * 16 + lo));
+                i += 2;
+            }
+            else {
+                path.push_back(target[i]);
+            }
+        }
+        return path;
+    }
+
+    StaticFileCache::StaticFileCache(fs::path root, size_t capacity, std::chrono::milliseconds revalidate_after)
+        : capacity_(std::max<size_t>(1, capacity))
+        , revalidate_after_(revalidate_after) {
+        std::error_code ec;
+        root_ = fs::weakly_canonical(root, ec);
+        if (ec) {
+            root_ = root.lexically_normal();
+        }
+        if (root_.has_parent_path() && root_.filename().empty()) {
+            root_ = root_.parent_path();
+        }
+    }
+
+    std::shared_ptr<const StaticFileCache::Entry> StaticFileCache::Lookup(std::string_view request_path) {
+        auto path = Resolve(request_path);
+        if (!path) {
+            return nullptr;
+        }
+
+        const std::string key = path->string();
+        const auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard lock{ mutex_ };
+            if (auto it = index_.find(key); it != index_.end()) {
+                lru_.splice(lru_.begin(), lru_, it->second);
+                const auto& entry = it->second->second;
+                if (now - entry->checked_at < revalidate_after_) {
+                    return entry;
+                }
+            }
+        }
+
+        auto entry = Load(*path);
+
+        std::lock_guard lock{ mutex_ };
+        if (auto it = index_.find(key); it != index_.end()) {
+            lru_.erase(it->second);
+            index_.erase(it);
+        }
+        if (!entry) {
+            return nullptr;
+        }
+
+        lru_.emplace_front(key, entry);
+        index_.emplace(key, lru_.begin());
+        if (lru_.size() > capacity_) {
+            index_.erase(lru_.back().first);
+            lru_.pop_back();
+        }
+        return entry;
+    }
+
+    std::optional<fs::path> StaticFileCache::Resolve(std::string_view request_path) const {
+        if (request_path.empty() || request_path.front() != '/') {
+            return std::nullopt;
+        }
+
+        std::string relative{ request_path.substr(1) };
+        if (relative.empty() || relative.back() == '/') {
+            relative += "index.html";
+        }
+
+        fs::path path = (root_ / fs::path(relative)).lexically_normal();
+
+        // Reject anything that escapes the root after "..", whatever the spelling.
+        auto [root_end, path_it] = std::mismatch(root_.begin(), root_.end(), path.begin(), path.end());
+        if (root_end != root_.end()) {
+            return std::nullopt;
+        }
+        return path;
+    }
+
+    std::shared_ptr<const StaticFileCache::Entry> StaticFileCache::Load(const fs::path& path) const {
+        std::error_code ec;
+        if (!fs::is_regular_file(path, ec)) {
+            return nullptr;
+        }
+
+        const auto size = fs::file_size(path, ec);
+        auto modified_at = GetModifiedAt(path);
+        if (ec || !modified_at) {
+            return nullptr;
+        }
+
+        auto entry = std::make_shared<Entry>();
+        entry->path = path;
+        entry->size = size;
+        entry->modified_at = *modified_at;
+        entry->etag = MakeFileETag(*modified_at, size);
+        entry->last_modified = FormatHttpDate(*modified_at);
+        entry->content_type = std::string(GetContentType(path));
+        entry->checked_at = std::chrono::steady_clock::now();
+
+        // Preferred encoding first.
+        for (auto [suffix, encoding] : { std::pair{ ".br"sv, "br"sv }, std::pair{ ".gz"sv, "gzip"sv } }) {
+            fs::path sibling = path;
+            sibling += suffix;
+            if (!fs::is_regular_file(sibling, ec)) {
+                continue;
+            }
+            const auto sibling_size = fs::file_size(sibling, ec);
+            auto sibling_modified_at = GetModifiedAt(sibling);
+            if (ec || !sibling_modified_at || *sibling_modified_at < *modified_at) {
+                continue;
+            }
+            std::string etag = MakeFileETag(*sibling_modified_at, sibling_size);
+            etag.insert(etag.size() - 1, "-" + std::string(encoding));
+            entry->precompressed.push_back({ sibling, sibling_size, std::string(encoding), std::move(etag) });
+        }
+
+        return entry;
+    }
+
+}  // namespace http_handler
@@ -0,0 +1,65 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace http_handler {
+
+    // LRU cache of stat results for files under www_root. Entries are re-validated
+    // after revalidate_after, so files replaced on disk are picked up without a restart.
+    // Descriptors are not cached: each response owns its own, because duplicated
+    // descriptors share one file offset.
+    class StaticFileCache {
+    public:
+        struct Variant {
+            std::filesystem::path path;
+            std::uint64_t size;
+            std::string encoding;
+            std::string etag;
+        };
+
+        struct Entry {
+            std::filesystem::path path;
+            std::uint64_t size;
+            std::string etag;
+            std::string last_modified;
+            std::chrono::system_clock::time_point modified_at;
+            std::string content_type;
+            std::vector<Variant> precompressed;
+            std::chrono::steady_clock::time_point checked_at;
+        };
+
+        explicit StaticFileCache(std::filesystem::path root, size_t capacity = 1024,
+            std::chrono::milliseconds revalidate_after = std::chrono::seconds{ 2 });
+
+        // Resolves a decoded request path ("/", "/app.js") to a regular file inside
+        // the root; returns nullptr when there is none.
+        std::shared_ptr<const Entry> Lookup(std::string_view request_path);
+
+    private:
+        using Lru = std::list<std::pair<std::string, std::shared_ptr<const Entry>>>;
+
+        std::optional<std::filesystem::path> Resolve(std::string_view request_path) const;
+        std::shared_ptr<const Entry> Load(const std::filesystem::path& path) const;
+
+        std::filesystem::path root_;
+        size_t capacity_;
+        std::chrono::milliseconds revalidate_after_;
+        std::mutex mutex_;
+        Lru lru_;
+        std::unordered_map<std::string, Lru::iterator> index_;
+    };
+
+    std::string FormatHttpDate(std::chrono::system_clock::time_point time);
+    std::optional<std::chrono::system_clock::time_point> ParseHttpDate(std::string_view date);
+    std::optional<std::string> DecodeUrlPath(std::string_view target);
+
+}  // namespace http_handler
@@ -1,68 +1,99 @@
-
 #pragma once
+#include "metrics.h"
+
 #include <boost/asio.hpp>
+#include <algorithm>
 #include <chrono>
 #include <functional>
 #include <memory>
 
 namespace net = boost::asio;
 
+// Fixed-timestep scheduler. Ticks are due at absolute deadlines start + k * period
+// and the handler always gets delta == period, so a slow tick neither drifts the
+// schedule nor hands the game one oversized step. A late wake-up runs the missed
+// ticks back to back, at most max_catch_up of them; ticks beyond that are dropped
+// and counted as skipped.
 class Ticker : public std::enable_shared_from_this<Ticker> {
 public:
     using Strand = net::strand<net::io_context::executor_type>;
     using Handler = std::function<void(std::chrono::milliseconds delta)>;
 
-    Ticker(Strand strand, std::chrono::milliseconds period, Handler handler)
+    Ticker(Strand strand, std::chrono::milliseconds period, Handler handler, unsigned max_catch_up = 4,
+        metrics::Registry* metrics = nullptr)
         : strand_(strand)
         , period_(period)
-        , handler_(std::move(handler))
-        , timer_(strand_) {
+        , max_catch_up_(std::max(1u, max_catch_up))
+        , metrics_(metrics)
+        , timer_(strand_)
+        , handler_(std::move(handler)) {
     }
 
     void Start() {
         net::dispatch(strand_, [self = shared_from_this()] {
-            self->last_tick_ = Clock::now();
+            self->deadline_ = Clock::now() + self->period_;
             self->ScheduleTick();
         });
     }
 
     void Stop() {
         net::dispatch(strand_, [self = shared_from_this()] {
+            // A wait that already completed is not cancelled; OnTick checks the flag.
+            self->stopped_ = true;
             boost::system::error_code ec;
             self->timer_.cancel(ec);
         });
     }
 
 private:
+    using Clock = std::chrono::steady_clock;
+
     void ScheduleTick() {
-        timer_.expires_after(period_);
+        timer_.expires_at(deadline_);
         timer_.async_wait([self = shared_from_this()](boost::system::error_code ec) {
             self->OnTick(ec);
         });
     }
 
     void OnTick(boost::system::error_code ec) {
-        using namespace std::chrono;
-        
-        if (!ec) {
-            auto this_tick = Clock::now();
-            auto delta = duration_cast<milliseconds>(this_tick - last_tick_);
-            last_tick_ = this_tick;
-            
+        if (ec || stopped_) {
+            return;
+        }
+
+        if (metrics_) {
+            metrics_->RecordTickJitter(std::max(Clock::duration::zero(), Clock::now() - deadline_));
+        }
+
+        unsigned ran = 0;
+        do {
             try {
-                handler_(delta);
+                handler_(period_);
             } catch (...) {
             }
-            
+            deadline_ += period_;
+        } while (++ran < max_catch_up_ && deadline_ <= Clock::now());
+
+        const auto now = Clock::now();
+        if (deadline_ <= now) {
+            const auto behind = (now - deadline_) / period_ + 1;
+            deadline_ += behind * period_;
+            if (metrics_) {
+                metrics_->CountSkippedTicks(static_cast<uint64_t>(behind));
+            }
+        }
+
+        if (!stopped_) {
             ScheduleTick();
         }
     }
 
-    using Clock = std::chrono::steady_clock;
-
     Strand strand_;
     std::chrono::milliseconds period_;
+    unsigned max_catch_up_;
+    metrics::Registry* metrics_;
     net::steady_timer timer_;
     Handler handler_;
-    std::chrono::steady_clock::time_point last_tick_;
+    Clock::time_point deadline_;
+    // Only touched on the strand.
+    bool stopped_ = false;
 };
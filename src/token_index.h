@@ -0,0 +1,326 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace model {
+
+    // 128-bit auth token; its text form is 32 lowercase hex digits.
+    struct Token {
+        uint64_t hi = 0;
+        uint64_t lo = 0;
+
+        static std::optional<Token> Parse(std::string_view hex) noexcept {
+            if (hex.size() != 32) {
+                return std::nullopt;
+            }
+            // Table lookup instead of range checks: random digits defeat the branch predictor.
+            uint64_t halves[2] = { 0, 0 };
+            uint8_t invalid = 0;
+            for (size_t i = 0; i < 32; ++i) {
+                const uint8_t digit = HEX_DIGITS[static_cast<unsigned char>(hex[i])];
+                invalid |= digit;
+                halves[i / 16] = (halves[i / 16] << 4) | (digit & 0xF);
+            }
+            if (invalid & 0x80) {
+                return std::nullopt;
+            }
+            return Token{ halves[0], halves[1] };
+        }
+
+        std::string ToString() const {
+            constexpr char digits[] = "0123456789abcdef";
+            std::string hex(32, '0');
+            for (size_t i = 0; i < 16; ++i) {
+                hex[15 - i] = digits[(hi >> (i * 4)) & 0xF];
+                hex[31 - i] = digits[(lo >> (i * 4)) & 0xF];
+            }
+            return hex;
+        }
+
+        bool Empty() const noexcept {
+            return hi == 0 && lo == 0;
+        }
+
+        auto operator<=>(const Token&) const = default;
+
+    private:
+        // Digit value of a hex character; 0x80 marks anything else.
+        static constexpr std::array<uint8_t, 256> HEX_DIGITS = [] {
+            std::array<uint8_t, 256> table{};
+            table.fill(0x80);
+            for (uint8_t i = 0; i < 10; ++i) {
+                table['0' + i] = i;
+            }
+            for (uint8_t i = 0; i < 6; ++i) {
+                table['a' + i] = 10 + i;
+                table['A' + i] = 10 + i;
+            }
+            return table;
+        }();
+    };
+
+    // Token -> Value map for auth lookups. Entries are split into shards by the top
+    // bits of the token, and each shard is a linear-probing table guarded by a
+    // seqlock. Find never blocks and may run on any thread concurrently with Insert
+    // and Erase, which serialize on a per-shard mutex. Value must be trivially
+    // copyable and free of padding, so it round-trips through the atomic payload
+    // words bit for bit; it takes one word per 8 bytes.
+    //
+    // A table outgrown by Insert is kept until the index is destroyed, because a
+    // reader may still be probing it; with doubling that costs at most as much
+    // again as the live tables.
+    template <typename Value>
+    class TokenIndex {
+        static_assert(std::is_trivially_copyable_v<Value>);
+        static_assert(std::has_unique_object_representations_v<Value>);
+
+        static constexpr size_t PAYLOAD_WORDS = (sizeof(Value) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        static_assert(PAYLOAD_WORDS <= 2, "keep slots within a cache line");
+
+        using ValueBytes = std::array<std::byte, sizeof(Value)>;
+        using Payload = std::array<uint64_t, PAYLOAD_WORDS>;
+
+    public:
+        TokenIndex() {
+            for (auto& shard : *shards_) {
+                shard.tables.push_back(std::make_unique<Table>(INITIAL_CAPACITY));
+                shard.table.store(shard.tables.back().get(), std::memory_order_relaxed);
+            }
+        }
+
+        TokenIndex(const TokenIndex&) = delete;
+        TokenIndex& operator=(const TokenIndex&) = delete;
+
+        // Not thread-safe; a moved-from index may only be destroyed or assigned to.
+        TokenIndex(TokenIndex&&) noexcept = default;
+        TokenIndex& operator=(TokenIndex&&) noexcept = default;
+
+        std::optional<Value> Find(const Token& token) const noexcept {
+            if (token.Empty()) {
+                return std::nullopt;
+            }
+
+            const Shard& shard = ShardOf(token);
+            const uint64_t hash = Hash(token);
+            for (;;) {
+                const uint64_t seq = shard.seq.load(std::memory_order_acquire);
+                if (seq & 1) {
+                    continue;
+                }
+
+                std::optional<Payload> payload;
+                const Table* table = shard.table.load(std::memory_order_acquire);
+                for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+                    const Slot& slot = table->slots[i];
+                    const uint64_t hi = slot.hi.load(std::memory_order_relaxed);
+                    const uint64_t lo = slot.lo.load(std::memory_order_relaxed);
+                    if (hi == 0 && lo == 0) {
+                        break;
+                    }
+                    if (hi == token.hi && lo == token.lo) {
+                        payload = Load(slot);
+                        break;
+                    }
+                }
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (shard.seq.load(std::memory_order_relaxed) == seq) {
+                    return payload ? std::optional{ Unpack(*payload) } : std::nullopt;
+                }
+            }
+        }
+
+        bool Contains(const Token& token) const noexcept {
+            return Find(token).has_value();
+        }
+
+        // Returns false if the token is already present or empty.
+        bool Insert(const Token& token, Value value) {
+            if (token.Empty()) {
+                return false;
+            }
+
+            Shard& shard = ShardOf(token);
+            std::lock_guard lock{ shard.mutex };
+            Table* table = shard.table.load(std::memory_order_relaxed);
+            if (FindSlot(*table, token)) {
+                return false;
+            }
+
+            // Keep the load factor at or below one half, so probe runs stay short
+            // and a reader always reaches an empty slot.
+            if ((shard.size + 1) * 2 > table->slots.size()) {
+                auto grown = std::make_unique<Table>(table->slots.size() * 2);
+                for (const Slot& slot : table->slots) {
+                    const Token existing{ slot.hi.load(std::memory_order_relaxed), slot.lo.load(std::memory_order_relaxed) };
+                    if (!existing.Empty()) {
+                        Place(*grown, existing, Load(slot));
+                    }
+                }
+                Place(*grown, token, Pack(value));
+                // Readers see either the old table or the complete new one.
+                shard.table.store(grown.get(), std::memory_order_release);
+                shard.tables.push_back(std::move(grown));
+            }
+            else {
+                BeginWrite(shard);
+                Place(*table, token, Pack(value));
+                EndWrite(shard);
+            }
+            ++shard.size;
+            return true;
+        }
+
+        bool Erase(const Token& token) {
+            if (token.Empty()) {
+                return false;
+            }
+
+            Shard& shard = ShardOf(token);
+            std::lock_guard lock{ shard.mutex };
+            Table& table = *shard.table.load(std::memory_order_relaxed);
+            auto found = FindSlot(table, token);
+            if (!found) {
+                return false;
+            }
+
+            BeginWrite(shard);
+            // Backward-shift deletion: no tombstones, so churn never degrades probes.
+            size_t hole = *found;
+            for (size_t i = (hole + 1) & table.mask;; i = (i + 1) & table.mask) {
+                Slot& slot = table.slots[i];
+                const Token moved{ slot.hi.load(std::memory_order_relaxed), slot.lo.load(std::memory_order_relaxed) };
+                if (moved.Empty()) {
+                    break;
+                }
+                const size_t home = Hash(moved) & table.mask;
+                if (((i - home) & table.mask) >= ((i - hole) & table.mask)) {
+                    Store(table.slots[hole], moved, Load(slot));
+                    hole = i;
+                }
+            }
+            Store(table.slots[hole], {}, {});
+            EndWrite(shard);
+
+            --shard.size;
+            return true;
+        }
+
+    private:
+        static constexpr size_t SHARD_BITS = 4;
+        static constexpr size_t INITIAL_CAPACITY = 64;
+
+        struct Slot {
+            std::atomic<uint64_t> hi{ 0 };
+            std::atomic<uint64_t> lo{ 0 };
+            std::array<std::atomic<uint64_t>, PAYLOAD_WORDS> value{};
+        };
+
+        struct Table {
+            explicit Table(size_t capacity)
+                : slots(capacity)
+                , mask(capacity - 1) {
+            }
+
+            std::vector<Slot> slots;
+            size_t mask;
+        };
+
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> seq{ 0 };
+            std::atomic<Table*> table{ nullptr };
+            std::mutex mutex;
+            size_t size = 0;
+            std::vector<std::unique_ptr<Table>> tables;
+        };
+
+        static uint64_t Hash(const Token& token) noexcept {
+            // Tokens are random, but lookups may carry client-chosen values.
+            return (token.lo ^ std::rotl(token.hi, 29)) * 0x9E3779B97F4A7C15ull;
+        }
+
+        static Payload Pack(Value value) noexcept {
+            const auto bytes = std::bit_cast<ValueBytes>(value);
+            Payload payload{};
+            std::memcpy(payload.data(), bytes.data(), bytes.size());
+            return payload;
+        }
+
+        static Value Unpack(const Payload& payload) noexcept {
+            ValueBytes bytes;
+            std::memcpy(bytes.data(), payload.data(), bytes.size());
+            return std::bit_cast<Value>(bytes);
+        }
+
+        static Payload Load(const Slot& slot) noexcept {
+            Payload payload;
+            for (size_t i = 0; i < PAYLOAD_WORDS; ++i) {
+                payload[i] = slot.value[i].load(std::memory_order_relaxed);
+            }
+            return payload;
+        }
+
+        Shard& ShardOf(const Token& token) noexcept {
+            return (*shards_)[token.hi >> (64 - SHARD_BITS)];
+        }
+
+        const Shard& ShardOf(const Token& token) const noexcept {
+            return (*shards_)[token.hi >> (64 - SHARD_BITS)];
+        }
+
+        static void BeginWrite(Shard& shard) noexcept {
+            shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        static void EndWrite(Shard& shard) noexcept {
+            shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        static void Store(Slot& slot, const Token& token, const Payload& payload) noexcept {
+            slot.hi.store(token.hi, std::memory_order_relaxed);
+            slot.lo.store(token.lo, std::memory_order_relaxed);
+            for (size_t i = 0; i < PAYLOAD_WORDS; ++i) {
+                slot.value[i].store(payload[i], std::memory_order_relaxed);
+            }
+        }
+
+        static void Place(Table& table, const Token& token, const Payload& payload) noexcept {
+            size_t i = Hash(token) & table.mask;
+            while (table.slots[i].hi.load(std::memory_order_relaxed) != 0
+                || table.slots[i].lo.load(std::memory_order_relaxed) != 0) {
+                i = (i + 1) & table.mask;
+            }
+            Store(table.slots[i], token, payload);
+        }
+
+        static std::optional<size_t> FindSlot(const Table& table, const Token& token) noexcept {
+            for (size_t i = Hash(token) & table.mask;; i = (i + 1) & table.mask) {
+                const uint64_t hi = table.slots[i].hi.load(std::memory_order_relaxed);
+                const uint64_t lo = table.slots[i].lo.load(std::memory_order_relaxed);
+                if (hi == 0 && lo == 0) {
+                    return std::nullopt;
+                }
+                if (hi == token.hi && lo == token.lo) {
+                    return i;
+                }
+            }
+        }
+
+        // Behind a pointer so the index, and the Game holding it, stay movable.
+        std::unique_ptr<std::array<Shard, size_t{ 1 } << SHARD_BITS>> shards_
+            = std::make_unique<std::array<Shard, size_t{ 1 } << SHARD_BITS>>();
+    };
+
+}  // namespace model